@@ -1,6 +1,6 @@
 import os
 from copy import copy
-from typing import List
+from typing import List, Optional, Tuple
 
 from jinja2 import Environment, PackageLoader
 
@@ -18,6 +18,9 @@ env = Environment(
 
 template = env.get_template('cpptiny.h.j2')
 
+# fragmentHeaderSize in runtimes/cpptiny/fragment.h
+_FRAGMENT_HEADER_SIZE = 5
+
 prim_types = {
     "bool": "bool",
     "int8": "int8_t",
@@ -28,39 +31,68 @@ prim_types = {
     "uint16": "uint16_t",
     "uint32": "uint32_t",
     "uint64": "uint64_t",
+    "float16": "float",
     "float32": "float",
     "float64": "double",
     "bytes": "char",
     "string": "char",
+    "flag": "bool",
 }
 
 
+def _storage_bits(bits: int) -> int:
+  for storage in (8, 16, 32, 64):
+    if bits <= storage:
+      return storage
+  raise RuntimeError(f"{bits} bits is too large to store")
+
+
 def _map_type(t: ProtoType) -> str:
   if t.name in prim_types:
     type_name = prim_types[t.name]
+  elif t.name in ("uint", "int"):
+    assert t.size is not None
+    type_name = f"{t.name}{_storage_bits(t.size)}_t"
   else:
     type_name = t.name
 
   return type_name
 
 
+size_types_map = {
+    "uint8": "uint8_t",
+    "uint16": "uint16_t",
+    "uint32": "uint32_t",
+    "varint": "Bakelite::VarintSize",
+}
+
+
+def _sized_array(type_name: str, member: ProtoStructMember) -> str:
+  size = size_type(member)
+  if size == "uint8":
+    # Avoid >> for older compilers
+    space = " " if type_name.endswith(">") else ""
+    return f"Bakelite::SizedArray<{type_name}{space}>"
+  return f"Bakelite::SizedArray<{type_name}, {size_types_map[size]}>"
+
+
 def _map_type_member(member: ProtoStructMember) -> str:
   type_name = _map_type(member.type)
 
   if member.type.name == "bytes" and member.type.size == 0 and member.arraySize == 0:
-    return f"Bakelite::SizedArray<Bakelite::SizedArray<{type_name}> >"
+    return _sized_array(_sized_array(type_name, member), member)
   elif member.type.name == "bytes" and member.type.size == 0:
-    return f"Bakelite::SizedArray<{type_name}>"
+    return _sized_array(type_name, member)
   elif (
       member.type.name == "string"
       and (member.type.size == 0)
       and member.arraySize == 0
   ):
-    return f"Bakelite::SizedArray<{type_name}*>"
+    return _sized_array(f"{type_name}*", member)
   elif member.type.name == "string" and (member.type.size == 0):
     return f"{type_name}*"
   elif member.arraySize == 0:
-    return f"Bakelite::SizedArray<{type_name}>"
+    return _sized_array(type_name, member)
   else:
     return type_name
 
@@ -82,9 +114,57 @@ def _array_postfix(member: ProtoStructMember) -> str:
     return f"[{member.arraySize}]"
 
 
-def overhead(size: int, crc_size: int) -> int:
-  cobs_overhead = int((size + 253)/254)
-  return cobs_overhead + crc_size + 1
+# A pointer to an array of the member's type
+def _column_decl(member: ProtoStructMember) -> str:
+  postfix = _array_postfix(member) + _size_postfix(member)
+  if postfix:
+    return f"{_map_type_member(member)} (*{member.name}){postfix}"
+  return f"{_map_type_member(member)} *{member.name}"
+
+
+def _codec(member: ProtoStructMember) -> str:
+  if has_annotation(member, "varint"):
+    return "Bakelite::VarintCodec"
+  return "Bakelite::RawCodec"
+
+
+def _setter_name(member: ProtoStructMember) -> str:
+  return f"set{member.name[0].upper()}{member.name[1:]}"
+
+
+# Union members live inside the union's value field
+def _union_member(member: ProtoStructMember) -> ProtoStructMember:
+  tmp_member = copy(member)
+  tmp_member.name = f"value.{member.name}"
+  return tmp_member
+
+
+# Arrays of these are copied directly, instead of element by element
+def _is_plain_array(member: ProtoStructMember) -> bool:
+  return (
+      (is_integer(member.type) or member.type.name in ("bool", "float32", "float64"))
+      and not has_annotation(member, "varint")
+      and scaled_encoding(member) is None
+  )
+
+
+def _float_literal(value: float, t: ProtoType) -> str:
+  literal = repr(float(value))
+  return literal + 'f' if t.name == "float32" else literal
+
+
+# CRC option: (runtime type, size in bytes)
+crc_types = {
+    "none": ("CrcNoop", 0),
+    "crc8": ("Crc8", 1),
+    "crc16": ("Crc16", 2),
+    "crc16_ccitt": ("Crc16Ccitt", 2),
+    "crc32": ("Crc32", 4),
+    "crc32c": ("Crc32c", 4),
+    "fletcher16": ("Fletcher16", 2),
+    "fletcher32": ("Fletcher32", 4),
+    "adler32": ("Adler32", 4),
+}
 
 
 def render(
@@ -96,10 +176,172 @@ def render(
 
   enums_types = {enum.name: enum for enum in enums}
   structs_types = {struct.name: struct for struct in structs}
+  wire_sizes = WireSizes(enums, structs)
+
+  def _size_literal(size: Optional[int]) -> str:
+    if size is None or size >= 0xFFFFFFFF:
+      return "Bakelite::unboundedSize"
+    return str(size)
+
+  def _size_expr(fn: str, terms: List[str]) -> str:
+    expr = terms[-1]
+    for term in reversed(terms[:-1]):
+      expr = f"Bakelite::{fn}({term}, {expr})"
+    return expr
+
+  def _min_packed_size(struct: ProtoStruct) -> str:
+    return str(wire_sizes.struct_min_size(struct))
+
+  def _max_packed_size(struct: ProtoStruct) -> str:
+    return _size_literal(wire_sizes.struct_size(struct))
+
+  # Heap used by unpack for one element of a member, or None if unbounded
+  def _element_heap_size(member: ProtoStructMember) -> Optional[str]:
+    t = member.type
+    if t.name in structs_types:
+      if _max_heap_size(structs_types[t.name]) == "0":
+        return "0"
+      return f"{t.name}::maxHeapSize()"
+    if t.name in ("bytes", "string") and t.size == 0:
+      if t.name == "bytes":
+        return _size_literal(max_count(member))
+      if has_annotation(member, "prefixed"):
+        # Including the null terminator
+        return _size_literal(max_count(member) + 1)
+      return None
+    return "0"
+
+  def _member_heap_size(member: ProtoStructMember) -> Optional[str]:
+    element = _element_heap_size(member)
+    if element is None:
+      return None
+    if member.arraySize is None:
+      return element
+    if member.arraySize > 0:
+      return "0" if element == "0" else f"Bakelite::mulSize({member.arraySize}, {element})"
+
+    tmp_member = copy(member)
+    tmp_member.arraySize = None
+    count = _size_literal(max_count(member))
+    terms = [f"Bakelite::mulSize({count}, sizeof({_map_type_member(tmp_member)}))"]
+    if element != "0":
+      terms.append(f"Bakelite::mulSize({count}, {element})")
+    return _size_expr("addSize", terms)
+
+  def _max_heap_size(struct: ProtoStruct) -> str:
+    sizes = [_member_heap_size(member) for member in struct.members]
+    if None in sizes:
+      return "Bakelite::unboundedSize"
+    terms = [size for size in sizes if size != "0"]
+    if not terms:
+      return "0"
+    return _size_expr("maxSize" if struct.kind == "union" else "addSize", terms)  # type: ignore
+
+  # Fixed size structs get a Columns struct and unpackColumns()
+  def _has_columns(struct: ProtoStruct) -> bool:
+    return (
+        struct.kind != "union"
+        and wire_sizes.is_fixed_size(struct)
+        and any(member.type.name != "unused" for member in struct.members)
+    )
+
+  # Members packed as they're stored in memory, which unpackColumns()
+  # copies straight from the packed message
+  def _is_column_copy(member: ProtoStructMember) -> bool:
+    if member.bitfieldGroup is not None or has_annotation(member, "delta"):
+      return False
+    t = member.type
+    if t.name in enums_types:
+      return is_integer(enums_types[t.name].type)
+    if t.name in ("bytes", "string"):
+      return bool(t.size)
+    return _is_plain_array(member)
+
+  def _column_copies(struct: ProtoStruct) -> List[Tuple[ProtoStructMember, int]]:
+    offsets = wire_sizes.member_offsets(struct)
+    return [(member, offsets[member.name]) for member in struct.members if _is_column_copy(member)]
+
+  def _column_unpacks(struct: ProtoStruct) -> List[ProtoStructMember]:
+    return [
+        member for member in struct.members
+        if member.type.name != "unused" and not _is_column_copy(member)
+    ]
+
+  def _bit_width(member: ProtoStructMember) -> int:
+    if member.type.name in enums_types:
+      width = bit_width(enums_types[member.type.name].type)
+    else:
+      width = bit_width(member.type)
+    assert width is not None
+    return width
+
+  def _bit_mask(width: int) -> str:
+    suffix = 'u' if width < 32 else 'ull'
+    return f"0x{(1 << width) - 1:x}{suffix}"
+
+  # All members of a bitfield are packed into a single word,
+  # which is written with one store
+  def _write_bitfield(members: List[ProtoStructMember]) -> str:
+    total = sum(_bit_width(member) for member in members)
+    word = f"uint{_storage_bits(total)}_t"
+    parts = []
+    shift = 0
+
+    for member in members:
+      width = _bit_width(member)
+      if member.type.name != "unused":
+        parts.append(f"(({word}){member.name} & {_bit_mask(width)}) << {shift}")
+      shift += width
+
+    expr = ' |\n      '.join(parts) if parts else '0'
+    return f"""writeBits(stream, ({word})(
+      {expr}
+    ), {total // 8});"""
+
+  # The bitfield is read with one load, then each member is extracted
+  def _read_bitfield(members: List[ProtoStructMember]) -> str:
+    total = sum(_bit_width(member) for member in members)
+    word = f"uint{_storage_bits(total)}_t"
+    lines = []
+    shift = 0
+
+    for member in members:
+      width = _bit_width(member)
+      value = f"(bits >> {shift}) & {_bit_mask(width)}"
+      if member.type.name == "unused":
+        pass
+      elif member.type.name in enums_types:
+        lines.append(f"{member.name} = ({member.type.name})({value});")
+      elif member.type.name == "int" or (
+          is_integer(member.type) and not member.type.name.startswith('u')
+      ):
+        lines.append(
+            f"{member.name} = Bakelite::signExtend<{_map_type(member.type)}, {width}>({value});")
+      else:
+        lines.append(f"{member.name} = {value};")
+      shift += width
+
+    body = ''.join(f"\n      {line}" for line in lines)
+    return f"""Bakelite::readBits<{word}>(stream, {total // 8}, [&]({word} bits) {{{body}
+    }});"""
 
-  def _write_type(member: ProtoStructMember) -> str:
+  def _write_type(member: Union[ProtoStructMember, List[ProtoStructMember]]) -> str:
+    if isinstance(member, list):
+      return _write_bitfield(member)
     if member.arraySize is not None:
       size_arg = f', {member.arraySize}' if member.arraySize > 0 else ''
+      if has_annotation(member, "delta"):
+        return f"Bakelite::writeDeltaArray<{_codec(member)}>(stream, {member.name}{size_arg});"
+      if member.type.name == "float16":
+        return f"writeHalfArray(stream, {member.name}{size_arg});"
+      scaled = scaled_encoding(member)
+      if scaled is not None:
+        return (
+            f"Bakelite::writeScaledArray<{_map_type(scaled.wireType)}>(stream, {member.name}{size_arg}, "
+            f"{_float_literal(1 / scaled.scale, member.type)}, {_float_literal(scaled.offset, member.type)});"
+        )
+      if _is_plain_array(member):
+        return f"writePrimitiveArray(stream, {member.name}{size_arg});"
       tmp_member = copy(member)
       tmp_member.arraySize = None
       tmp_member.name = "val"
@@ -116,6 +358,16 @@ def render(
         and member.type.name != "bytes"
         and member.type.name != "string"
     ):
+      if has_annotation(member, "varint"):
+        return f"writeVarint(stream, {member.name});"
+      if member.type.name == "float16":
+        return f"writeHalf(stream, {member.name});"
+      scaled = scaled_encoding(member)
+      if scaled is not None:
+        return (
+            f"Bakelite::writeScaled<{_map_type(scaled.wireType)}>(stream, {member.name}, "
+            f"{_float_literal(1 / scaled.scale, member.type)}, {_float_literal(scaled.offset, member.type)});"
+        )
       return f"write(stream, {member.name});"
     elif member.type.name == "bytes":
       if member.type.size != 0:
@@ -125,14 +377,33 @@ def render(
     elif member.type.name == "string":
       if member.type.size != 0:
         return f"writeString(stream, {member.name}, {member.type.size});"
+      elif has_annotation(member, "prefixed") and size_type(member) != "uint8":
+        size = size_types_map[size_type(member)]
+        return f"Bakelite::writePrefixedString<{size}>(stream, {member.name});"
+      elif has_annotation(member, "prefixed"):
+        return f"writePrefixedString(stream, {member.name});"
       else:
         return f"writeString(stream, {member.name});"
     else:
       raise RuntimeError(f"Unkown type {member.type.name}")
 
-  def _read_type(member: ProtoStructMember) -> str:
+  def _read_type(member: Union[ProtoStructMember, List[ProtoStructMember]]) -> str:
+    if isinstance(member, list):
+      return _read_bitfield(member)
     if member.arraySize is not None:
       size_arg = f', {member.arraySize}' if member.arraySize > 0 else ''
+      if has_annotation(member, "delta"):
+        return f"Bakelite::readDeltaArray<{_codec(member)}>(stream, {member.name}{size_arg});"
+      if member.type.name == "float16":
+        return f"readHalfArray(stream, {member.name}{size_arg});"
+      scaled = scaled_encoding(member)
+      if scaled is not None:
+        return (
+            f"Bakelite::readScaledArray<{_map_type(scaled.wireType)}>(stream, {member.name}{size_arg}, "
+            f"{_float_literal(scaled.scale, member.type)}, {_float_literal(scaled.offset, member.type)});"
+        )
+      if _is_plain_array(member):
+        return f"readPrimitiveArray(stream, {member.name}{size_arg});"
       tmp_member = copy(member)
       tmp_member.arraySize = None
       tmp_member.name = "val"
@@ -149,6 +420,16 @@ def render(
         and member.type.name != "bytes"
         and member.type.name != "string"
     ):
+      if has_annotation(member, "varint"):
+        return f"readVarint(stream, {member.name});"
+      if member.type.name == "float16":
+        return f"readHalf(stream, {member.name});"
+      scaled = scaled_encoding(member)
+      if scaled is not None:
+        return (
+            f"Bakelite::readScaled<{_map_type(scaled.wireType)}>(stream, {member.name}, "
+            f"{_float_literal(scaled.scale, member.type)}, {_float_literal(scaled.offset, member.type)});"
+        )
       return f"read(stream, {member.name});"
     elif member.type.name == "bytes":
       if member.type.size != 0:
@@ -158,6 +439,11 @@ def render(
     elif member.type.name == "string":
       if member.type.size != 0:
         return f"readString(stream, {member.name}, {member.type.size});"
+      elif has_annotation(member, "prefixed") and size_type(member) != "uint8":
+        size = size_types_map[size_type(member)]
+        return f"Bakelite::readPrefixedString<{size}>(stream, {member.name});"
+      elif has_annotation(member, "prefixed"):
+        return f"readPrefixedString(stream, {member.name});"
       else:
         return f"readString(stream, {member.name});"
     else:
@@ -165,6 +451,10 @@ def render(
 
   message_ids = []
   framer = ""
+  framer_with_stats = ""
+  fragmentation = False
+  max_length = 0
+  fixed_messages = []
 
   if proto is not None:
     message_ids = [(msg.name, msg.number) for msg in proto.message_ids]
@@ -172,6 +462,7 @@ def render(
     crc = options.get("crc", "none").lower()
     framing = options.get("framing", "").lower()
     max_length = options.get("maxLength", None)
+    fragmentation = options.get("fragmentation", "false").lower() == "true"
 
     if framing == "":
       raise RuntimeError("A frame type must be specified")
@@ -179,26 +470,34 @@ def render(
     if max_length is None:
       raise RuntimeError("maxLength must be specified")
 
-    if crc == "none":
-      crc_type = "CrcNoop"
-      crc_size = 0
-    elif crc == "crc8":
-      crc_type = "Crc8"
-      crc_size = 1
-    elif crc == "crc16":
-      crc_type = "Crc16"
-      crc_size = 2
-    elif crc == "crc32":
-      crc_type = "Crc32"
-      crc_size = 4
-    else:
+    if crc not in crc_types:
       raise RuntimeError(f"Unkown CRC type {crc}")
-
+    crc_type, _ = crc_types[crc]
+
+    messages = [structs_types[name] for name, _ in message_ids if name in structs_types]
+    if max_length.lower() == "auto":
+      # Fit the largest message
+      max_length = 0
+      for message in messages:
+        size = wire_sizes.struct_size(message)
+        if size is None or size >= 0xFFFFFFFF:
+          raise RuntimeError(f"maxLength = auto requires messages with a maximum size, {message.name} has none")
+        max_length = max(max_length, size)
     max_length = int(max_length)
-    max_length += overhead(int(max_length), crc_size)
+
+    # Every fragment needs room for its header and at least a byte of data
+    if fragmentation and max_length < _FRAGMENT_HEADER_SIZE:
+      raise RuntimeError(f"fragmentation requires maxLength of at least {_FRAGMENT_HEADER_SIZE}")
+
+    # Only fixed size messages are checked against maxLength, variable
+    # length messages are usually smaller than their worst case
+    if not fragmentation:
+      fixed_messages = [message.name for message in messages if wire_sizes.is_fixed_size(message)]
 
     if framing == "cobs":
-      framer = f"Bakelite::CobsFramer<Bakelite::{crc_type}, {max_length}>"
+      # One extra byte for the message ID
+      framer = f"Bakelite::CobsFramer<Bakelite::{crc_type}, {max_length + 1}>"
+      framer_with_stats = f"Bakelite::CobsFramer<Bakelite::{crc_type}, {max_length + 1}, S>"
     else:
       raise RuntimeError(f"Unkown CRC type {crc}")
 
@@ -213,7 +512,21 @@ def render(
       size_postfix=_size_postfix,
       write_type=_write_type,
       read_type=_read_type,
+      bitfield_groups=bitfield_groups,
+      setter_name=_setter_name,
+      union_member=_union_member,
+      min_packed_size=_min_packed_size,
+      max_packed_size=_max_packed_size,
+      max_heap_size=_max_heap_size,
+      has_columns=_has_columns,
+      column_decl=_column_decl,
+      column_copies=_column_copies,
+      column_unpacks=_column_unpacks,
       framer=framer,
+      framer_with_stats=framer_with_stats,
+      fragmentation=fragmentation,
+      max_length=max_length,
+      fixed_messages=fixed_messages,
       message_ids=message_ids,
   )
 
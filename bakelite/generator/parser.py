@@ -1,6 +1,7 @@
+import math
 import os
 from dataclasses import dataclass
-from typing import List, Tuple, Type, TypeVar
+from typing import Dict, List, Tuple, Type, TypeVar
 
 from lark import Lark
 from lark.visitors import Transformer
@@ -40,6 +41,11 @@ class _Number:
   value: int
 
 
+@dataclass
+class _Bitfield:
+  members: List[ProtoStructMember]
+
+
 @dataclass
 class _ProtoMessageIds:
   ids: List[ProtoMessageId]
@@ -92,6 +98,22 @@ class TreeTransformer(Transformer):
         name=str(args[0]), arguments=_find_many(args, ProtoAnnotationArg)
     )
 
+  def bitfield(self, args: List[Any]) -> _Bitfield:
+    return _Bitfield(members=_find_many(args, ProtoStructMember))
+
+  def bitfield_struct(self, args: List[Any]) -> ProtoStruct:
+    members = _find_many(args, ProtoStructMember)
+    for member in members:
+      member.bitfieldGroup = 0
+
+    return ProtoStruct(
+        name=_find_one(args, _Name),
+        members=members,
+        comment=_find_one(args, _Comment),
+        annotations=_find_many(args, ProtoAnnotation),
+        kind="bitfield",
+    )
+
   def comment(self, args: List[Any]) -> _Comment:
     return _Comment(value=str(args[0]))
 
@@ -121,6 +143,9 @@ class TreeTransformer(Transformer):
   def prim(self, args: List[Any]) -> ProtoType:
     return ProtoType(name=str(args[0]), size=0)
 
+  def prim_bits(self, args: List[Any]) -> ProtoType:
+    return ProtoType(name=str(args[0]), size=int(args[1]))
+
   def prim_variable(self, args: List[Any]) -> ProtoType:
     if len(args) > 1:
       return ProtoType(name=str(args[0]), size=int(args[1]))
@@ -157,9 +182,23 @@ class TreeTransformer(Transformer):
     )
 
   def struct(self, args: List[Any]) -> ProtoStruct:
+    members: List[ProtoStructMember] = []
+    group = 0
+
+    # Embedded bitfields are flattened into the struct,
+    # each bitfield's members are tagged with a group number
+    for arg in args:
+      if isinstance(arg, ProtoStructMember):
+        members.append(arg)
+      elif isinstance(arg, _Bitfield):
+        for member in arg.members:
+          member.bitfieldGroup = group
+          members.append(member)
+        group += 1
+
     return ProtoStruct(
         name=_find_one(args, _Name),
-        members=_find_many(args, ProtoStructMember),
+        members=members,
         comment=_find_one(args, _Comment),
         annotations=_find_many(args, ProtoAnnotation),
     )
@@ -174,6 +213,15 @@ class TreeTransformer(Transformer):
         arraySize=_find_one(args, _Array),
     )
 
+  def union(self, args: List[Any]) -> ProtoStruct:
+    return ProtoStruct(
+        name=_find_one(args, _Name),
+        members=_find_many(args, ProtoStructMember),
+        comment=_find_one(args, _Comment),
+        annotations=_find_many(args, ProtoAnnotation),
+        kind="union",
+    )
+
   def value(self, args: List[Any]) -> _Value:
     return _Value(value=str(args[0]))
 
@@ -184,11 +232,119 @@ class TreeTransformer(Transformer):
       return ProtoType(name=str(args[0]), size=None)
 
 
+def _member_bit_width(member: ProtoStructMember, enum_map: Dict[str, ProtoEnum]) -> Optional[int]:
+  if member.type.name in enum_map:
+    return bit_width(enum_map[member.type.name].type)
+  return bit_width(member.type)
+
+
+def _validate_bitfield(struct: ProtoStruct, members: List[ProtoStructMember],
+                       enum_map: Dict[str, ProtoEnum]) -> None:
+  total = 0
+  for member in members:
+    name = f"{struct.name}.{member.name}"
+    width = _member_bit_width(member, enum_map)
+
+    if width is None:
+      raise ValidationError(f"{name}: {member.type.name} can't be used in a bitfield")
+    if width < 1 or width > 64:
+      raise ValidationError(f"{name}: bitfield members must be between 1 and 64 bits")
+    if member.arraySize is not None:
+      raise ValidationError(f"{name}: arrays can't be used in a bitfield")
+    if member.annotations:
+      raise ValidationError(f"{name}: annotations can't be used in a bitfield")
+
+    total += width
+
+  if total % 8 != 0:
+    raise ValidationError(
+        f"{struct.name}: bitfields must be a multiple of 8 bits, found {total} bits")
+  if total > 64:
+    raise ValidationError(
+        f"{struct.name}: bitfields must not be larger than 64 bits, found {total} bits")
+
+
+def _validate_member(struct: ProtoStruct, member: ProtoStructMember,
+                     enum_map: Dict[str, ProtoEnum]) -> None:
+  name = f"{struct.name}.{member.name}"
+
+  if member.bitfieldGroup is None:
+    if is_bit_type(member.type) or (
+        member.type.name in enum_map and is_bit_type(enum_map[member.type.name].type)
+    ):
+      raise ValidationError(f"{name}: bitfield types can only be used in a bitfield")
+
+  if has_annotation(member, "varint") and not is_integer(member.type):
+    raise ValidationError(f"{name}: @varint can only be used with integer types")
+
+  if has_annotation(member, "prefixed") and not (
+      member.type.name == "string" and member.type.size == 0
+  ):
+    raise ValidationError(f"{name}: @prefixed can only be used with string[]")
+
+  if has_annotation(member, "size"):
+    try:
+      size_type(member)
+    except ValueError as e:
+      raise ValidationError(f"{name}: {e}") from e
+    if not has_size_prefix(member):
+      raise ValidationError(
+          f"{name}: @size can only be used with variable length arrays, bytes[] and @prefixed string[]")
+
+  if has_annotation(member, "offset") and not has_annotation(member, "scale"):
+    raise ValidationError(f"{name}: @offset can only be used with @scale")
+
+  try:
+    scaled = scaled_encoding(member)
+  except ValueError as e:
+    raise ValidationError(f"{name}: {e}") from e
+  if scaled is not None:
+    if member.type.name not in ("float32", "float64"):
+      raise ValidationError(f"{name}: @scale can only be used with float32 or float64")
+    if not is_integer(scaled.wireType):
+      raise ValidationError(f"{name}: @scale wire type must be an integer type")
+    if scaled.scale == 0 or not math.isfinite(scaled.scale):
+      raise ValidationError(f"{name}: @scale factor must be a finite, non-zero number")
+    if not math.isfinite(scaled.offset):
+      raise ValidationError(f"{name}: @offset must be a finite number")
+
+  if has_annotation(member, "delta"):
+    if member.arraySize is None:
+      raise ValidationError(f"{name}: @delta can only be used with arrays")
+    if not is_integer(member.type):
+      raise ValidationError(f"{name}: @delta can only be used with integer arrays")
+
+
 def validate(enums: List[ProtoEnum], structs: List[ProtoStruct],
              protocol: Protocol, _comments: List[str]) -> None:
-  _enum_map = {enum.name: enum for enum in enums}
+  enum_map = {enum.name: enum for enum in enums}
   struct_map = {struct.name: struct for struct in structs}
 
+  for enum in enums:
+    if enum.type.name in ("flag", "unused"):
+      raise ValidationError(f"{enum.name}: enums can't use the {enum.type.name} type")
+
+  for struct in structs:
+    if struct.kind == "union":
+      if not struct.members:
+        raise ValidationError(f"{struct.name}: unions must have at least one member")
+      if len(struct.members) > 255:
+        raise ValidationError(f"{struct.name}: unions can have at most 255 members")
+      for member in struct.members:
+        if member.value is not None:
+          raise ValidationError(
+              f"{struct.name}.{member.name}: union members can't have default values")
+        # Kind::None is the empty union's tag in C++
+        if member.name == "None":
+          raise ValidationError(f"{struct.name}.None: None is reserved for empty unions")
+
+    for member in struct.members:
+      _validate_member(struct, member, enum_map)
+
+    for item in bitfield_groups(struct):
+      if isinstance(item, list):
+        _validate_bitfield(struct, item, enum_map)
+
   if not protocol:
     return
 
@@ -29,10 +29,14 @@ def _map_type(member: ProtoStructMember) -> str:
       "uint16": "int",
       "uint32": "int",
       "uint64": "int",
+      "float16": "float",
       "float32": "float",
       "float64": "float",
       "bytes": "bytes",
       "string": "str",
+      "flag": "bool",
+      "uint": "int",
+      "int": "int",
   }
 
   if member.type.name in prim_types:
@@ -0,0 +1,426 @@
+/*
+ * Capture files
+ *
+ * A capture is an append-only file of timestamped frames, with a sidecar
+ * index (the capture's path plus ".idx") of where each frame starts.
+ * Readers mmap both, so frames can be found by time or message ID and
+ * unpacked straight from the mapping, without copying them.
+ *
+ * Both files start with a CaptureHeader. Each frame in the capture is a
+ * CaptureRecord followed by the frame, padded to 8 bytes. Frames are
+ * stored as the framer returns them, a message ID followed by the message,
+ * unless captureRaw is set, in which case they're the bytes as they were
+ * read from the wire. Integers are in the writer's byte order, a reader
+ * on a host with the other byte order rejects the file.
+ *
+ * Timestamps are in whatever units the writer chooses. Seeking by time
+ * assumes they never decrease.
+ */
+#if defined(BAKELITE_HOST_TOOLS) && (defined(__unix__) || defined(__APPLE__))
+
+// CaptureRecord flags
+constexpr uint8_t captureSent = 1;  // Sent, rather than received
+constexpr uint8_t captureRaw = 2;   // Undecoded bytes from the wire
+
+constexpr uint32_t captureByteOrder = 0x01020304;
+constexpr size_t captureAlignment = 8;
+
+struct CaptureHeader {
+  char magic[8];
+  uint32_t byteOrder;
+  uint32_t reserved;
+};
+
+struct CaptureRecord {
+  uint64_t timestamp;
+  uint32_t length;
+  uint8_t id;
+  uint8_t flags;
+  uint16_t reserved;
+};
+
+struct CaptureIndexEntry {
+  uint64_t timestamp;
+  // Offset of the frame's CaptureRecord in the capture
+  uint64_t offset;
+  uint32_t length;
+  uint8_t id;
+  uint8_t flags;
+  uint16_t reserved;
+};
+
+static const char captureMagic[8] = { 'B', 'K', 'L', 'C', 'A', 'P', '1', 0 };
+static const char captureIndexMagic[8] = { 'B', 'K', 'L', 'I', 'D', 'X', '1', 0 };
+
+// The message ID of a frame, without decoding it. A raw frame's first
+// COBS code is 1 if its first byte, the ID, is 0.
+static uint8_t captureFrameId(const char *data, size_t length, uint8_t flags) {
+  if(!(flags & captureRaw)) {
+    return length > 0 ? (uint8_t)data[0] : 0;
+  }
+  if(length < 2 || data[0] == 1) {
+    return 0;
+  }
+  return (uint8_t)data[1];
+}
+
+class CaptureWriter {
+public:
+  CaptureWriter() = default;
+  CaptureWriter(const CaptureWriter &) = delete;
+  CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+  ~CaptureWriter() {
+    close();
+  }
+
+  // Creates path and its index, replacing them if they exist.
+  // Returns -1 and sets errno if either can't be created.
+  int open(const char *path) {
+    close();
+
+    std::string indexPath = std::string(path) + ".idx";
+    m_file = fopen(path, "wb");
+    m_index = fopen(indexPath.c_str(), "wb");
+    if(m_file == nullptr || m_index == nullptr) {
+      close();
+      return -1;
+    }
+
+    m_offset = 0;
+    if(writeHeader(m_file, captureMagic) != 0 || writeHeader(m_index, captureIndexMagic) != 0) {
+      close();
+      return -1;
+    }
+    m_offset = sizeof(CaptureHeader);
+    return 0;
+  }
+
+  // data is a frame from the framer, or raw wire bytes with captureRaw.
+  int write(uint64_t timestamp, const char *data, size_t length, uint8_t flags = 0) {
+    static const char padding[captureAlignment] = {};
+    if(m_file == nullptr) {
+      return -1;
+    }
+
+    CaptureRecord record = {};
+    record.timestamp = timestamp;
+    record.length = (uint32_t)length;
+    record.id = captureFrameId(data, length, flags);
+    record.flags = flags;
+
+    CaptureIndexEntry entry = {};
+    entry.timestamp = timestamp;
+    entry.offset = m_offset;
+    entry.length = record.length;
+    entry.id = record.id;
+    entry.flags = flags;
+
+    size_t pad = (captureAlignment - length % captureAlignment) % captureAlignment;
+    if(
+      fwrite(&record, sizeof(record), 1, m_file) != 1 ||
+      fwrite(data, 1, length, m_file) != length ||
+      fwrite(padding, 1, pad, m_file) != pad ||
+      fwrite(&entry, sizeof(entry), 1, m_index) != 1
+    ) {
+      return -1;
+    }
+    m_offset += sizeof(record) + length + pad;
+    return 0;
+  }
+
+  int flush() {
+    if(m_file == nullptr || fflush(m_file) != 0 || fflush(m_index) != 0) {
+      return -1;
+    }
+    return 0;
+  }
+
+  void close() {
+    if(m_file != nullptr) {
+      fclose(m_file);
+      m_file = nullptr;
+    }
+    if(m_index != nullptr) {
+      fclose(m_index);
+      m_index = nullptr;
+    }
+  }
+
+private:
+  static int writeHeader(FILE *file, const char *magic) {
+    CaptureHeader header = {};
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.byteOrder = captureByteOrder;
+    return fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+  }
+
+  FILE *m_file = nullptr;
+  FILE *m_index = nullptr;
+  uint64_t m_offset = 0;
+};
+
+// A frame in a mapped capture. data points into the mapping, and is
+// valid until the reader is closed.
+struct CaptureFrame {
+  uint64_t timestamp;
+  const char *data;
+  uint32_t length;
+  uint8_t id;
+  uint8_t flags;
+
+  // A stream over the message, after the ID, to pass to unpack
+  BufferStream stream(char *heap = nullptr, uint32_t heapSize = 0) const {
+    if(length == 0) {
+      return BufferStream(nullptr, 0, heap, heapSize);
+    }
+    return BufferStream((char *)data + 1, length - 1, heap, heapSize);
+  }
+};
+
+class CaptureReader {
+public:
+  class Iterator {
+  public:
+    Iterator(const CaptureReader *reader, size_t pos): m_reader(reader), m_pos(pos) {}
+
+    CaptureFrame operator*() const {
+      return (*m_reader)[m_pos];
+    }
+
+    Iterator &operator++() {
+      m_pos++;
+      return *this;
+    }
+
+    bool operator!=(const Iterator &other) const {
+      return m_pos != other.m_pos;
+    }
+
+  private:
+    const CaptureReader *m_reader;
+    size_t m_pos;
+  };
+
+  CaptureReader() = default;
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader &operator=(const CaptureReader &) = delete;
+
+  ~CaptureReader() {
+    close();
+  }
+
+  // Maps path and its index. If the index is missing, corrupt, or doesn't
+  // match the capture (for example, the writer didn't flush it before a
+  // crash), it's rebuilt in memory from the capture. A partly written last
+  // frame is ignored.
+  // Returns -1 and sets errno if path can't be mapped, or -2 if it isn't a
+  // capture written on a host with the same byte order.
+  int open(const char *path) {
+    close();
+
+    int rcode = map(path, &m_data, &m_dataSize);
+    if(rcode != 0) {
+      return rcode;
+    }
+    if(!validHeader(m_data, m_dataSize, captureMagic)) {
+      close();
+      return -2;
+    }
+
+    std::string indexPath = std::string(path) + ".idx";
+    if(map(indexPath.c_str(), &m_indexData, &m_indexSize) == 0 && indexMatches()) {
+      m_entries = (const CaptureIndexEntry *)(m_indexData + sizeof(CaptureHeader));
+      m_count = (m_indexSize - sizeof(CaptureHeader)) / sizeof(CaptureIndexEntry);
+      madvise((void *)m_indexData, m_indexSize, MADV_WILLNEED);
+      return 0;
+    }
+
+    unmap(&m_indexData, &m_indexSize);
+    rebuildIndex();
+    m_indexRebuilt = true;
+    return 0;
+  }
+
+  void close() {
+    unmap(&m_data, &m_dataSize);
+    unmap(&m_indexData, &m_indexSize);
+    m_rebuilt.clear();
+    m_entries = nullptr;
+    m_count = 0;
+    m_indexRebuilt = false;
+  }
+
+  // Frames in the capture
+  size_t size() const {
+    return m_count;
+  }
+
+  CaptureFrame operator[](size_t i) const {
+    const CaptureIndexEntry &entry = m_entries[i];
+    CaptureFrame frame;
+    frame.timestamp = entry.timestamp;
+    frame.data = m_data + entry.offset + sizeof(CaptureRecord);
+    frame.length = entry.length;
+    frame.id = entry.id;
+    frame.flags = entry.flags;
+    return frame;
+  }
+
+  Iterator begin() const {
+    return Iterator(this, 0);
+  }
+
+  Iterator end() const {
+    return Iterator(this, m_count);
+  }
+
+  // The first frame at or after timestamp, or size() if there isn't one
+  size_t seekTime(uint64_t timestamp) const {
+    size_t low = 0;
+    size_t high = m_count;
+    while(low < high) {
+      size_t mid = low + (high - low) / 2;
+      if(m_entries[mid].timestamp < timestamp) {
+        low = mid + 1;
+      }
+      else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  // The first frame from from on with message ID id, or size() if there
+  // isn't one
+  size_t seekId(uint8_t id, size_t from = 0) const {
+    for(size_t i = from; i < m_count; i++) {
+      if(m_entries[i].id == id) {
+        return i;
+      }
+    }
+    return m_count;
+  }
+
+  // True if the index was rebuilt from the capture, rather than mapped
+  bool indexRebuilt() const {
+    return m_indexRebuilt;
+  }
+
+private:
+  // Returns -1 and sets errno if path can't be mapped, or -2 if it's empty
+  static int map(const char *path, const char **data, size_t *size) {
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0) {
+      return -1;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0) {
+      int error = errno;
+      ::close(fd);
+      errno = error;
+      return -1;
+    }
+    if(info.st_size == 0) {
+      ::close(fd);
+      return -2;
+    }
+
+    void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED) {
+      return -1;
+    }
+
+    *data = (const char *)mapping;
+    *size = (size_t)info.st_size;
+    return 0;
+  }
+
+  static void unmap(const char **data, size_t *size) {
+    if(*data != nullptr) {
+      munmap((void *)*data, *size);
+      *data = nullptr;
+      *size = 0;
+    }
+  }
+
+  static bool validHeader(const char *data, size_t size, const char *magic) {
+    CaptureHeader header;
+    if(size < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    return memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+      header.byteOrder == captureByteOrder;
+  }
+
+  static uint64_t recordSize(uint32_t length) {
+    return sizeof(CaptureRecord) + ((uint64_t)length + captureAlignment - 1) / captureAlignment * captureAlignment;
+  }
+
+  // The index matches if every frame it points to is inside the capture,
+  // and it ends exactly where the capture does. operator[] relies on this,
+  // so a corrupt index can't point outside the mapping.
+  bool indexMatches() const {
+    if(
+      !validHeader(m_indexData, m_indexSize, captureIndexMagic) ||
+      (m_indexSize - sizeof(CaptureHeader)) % sizeof(CaptureIndexEntry) != 0
+    ) {
+      return false;
+    }
+
+    size_t count = (m_indexSize - sizeof(CaptureHeader)) / sizeof(CaptureIndexEntry);
+    if(count == 0) {
+      return m_dataSize == sizeof(CaptureHeader);
+    }
+
+    auto entries = (const CaptureIndexEntry *)(m_indexData + sizeof(CaptureHeader));
+    for(size_t i = 0; i < count; i++) {
+      uint64_t offset = entries[i].offset;
+      if(
+        offset < sizeof(CaptureHeader) || offset > m_dataSize ||
+        recordSize(entries[i].length) > m_dataSize - offset
+      ) {
+        return false;
+      }
+    }
+    const CaptureIndexEntry &last = entries[count - 1];
+    return last.offset + recordSize(last.length) == m_dataSize;
+  }
+
+  void rebuildIndex() {
+    size_t offset = sizeof(CaptureHeader);
+    while(offset + sizeof(CaptureRecord) <= m_dataSize) {
+      CaptureRecord record;
+      memcpy(&record, m_data + offset, sizeof(record));
+      if(recordSize(record.length) > m_dataSize - offset) {
+        break;
+      }
+
+      CaptureIndexEntry entry = {};
+      entry.timestamp = record.timestamp;
+      entry.offset = offset;
+      entry.length = record.length;
+      entry.id = record.id;
+      entry.flags = record.flags;
+      m_rebuilt.push_back(entry);
+      offset += (size_t)recordSize(record.length);
+    }
+
+    m_entries = m_rebuilt.data();
+    m_count = m_rebuilt.size();
+  }
+
+  const char *m_data = nullptr;
+  size_t m_dataSize = 0;
+  const char *m_indexData = nullptr;
+  size_t m_indexSize = 0;
+
+  std::vector<CaptureIndexEntry> m_rebuilt;
+  const CaptureIndexEntry *m_entries = nullptr;
+  size_t m_count = 0;
+  bool m_indexRebuilt = false;
+};
+#endif
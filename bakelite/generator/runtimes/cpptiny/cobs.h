@@ -1,26 +1,38 @@
-enum class CobsDecodeState {
-  Decoded,
-  NotReady,
-  DecodeFailure,
-  CrcFailure,
-  BufferOverrun,
-};
-
-template <class C, size_t BufferSize>
-class CobsFramer {
+// Checks a frame's message ID and length (including the ID byte) before
+// it's decoded, returning false to drop it
+using FrameFilter = bool (*)(uint8_t id, size_t length);
+
+// S is the statistics policy, see stats.h. NoStats takes no space,
+// since it's an empty base class.
+template <class C, size_t BufferSize, class S = NoStats>
+class CobsFramer : private S {
 public:
+  using CrcType = C;
+  using Stats = S;
+
+  // crc is the frame's CRC, covering the data before framing
   struct Result {
     int status;
     size_t length;
     char *data;
+    uint32_t crc;
   };
 
   struct DecodeResult {
     CobsDecodeState status;
     size_t length;
     char *data;
+    uint32_t crc;
   };
 
+  S &stats() {
+    return *this;
+  }
+
+  const S &stats() const {
+    return *this;
+  }
+
   char *readBuffer() {
     return m_readBuffer;
   }
@@ -33,6 +45,12 @@ public:
     return m_writePtr;
   }
 
+  // Frames the filter rejects are dropped without decoding them, or
+  // checking their CRC
+  void setFrameFilter(FrameFilter filter) {
+    m_filter = filter;
+  }
+
   size_t writeBufferSize() {
     return sizeof(m_writeBuffer) - overhead(BufferSize);
   }
@@ -48,10 +66,10 @@ public:
   Result encodeFrame(size_t length) {
     assert(length <= BufferSize);
 
+    C crc;
     if(C::size() > 0) {
-      C crc;
       crc.update(m_writePtr, length);
-      auto crc_val = crc.value();
+      auto crc_val = toLittleEndian(crc.value());
       memcpy(m_writePtr + length, (void *)&crc_val, sizeof(crc_val));
     }
 
@@ -62,56 +80,137 @@ public:
     }
 
     m_writeBuffer[result.out_len] = 0;
+    stats().frameSent(result.out_len + 1);
+    stats().trace(TraceEvent::Encoded, 0);
 
-    return { 0, result.out_len + 1, m_writeBuffer };
+    return { 0, result.out_len + 1, m_writeBuffer, (uint32_t)crc.value() };
   }
 
   DecodeResult readFrameByte(char byte) {
+    stats().byteReceived();
+
+    // Most bytes are data in the middle of a frame. Code bytes, the
+    // delimiter and the end of the buffer take the slow path, as does
+    // discarding, which only happens at the start of the buffer.
+    size_t index = m_readPos - m_readBuffer;
+    if(byte != 0 && index != m_nextCode && index + 1 < sizeof(m_readBuffer)) {
+      *m_readPos++ = byte;
+      return { CobsDecodeState::NotReady, 0, nullptr };
+    }
+    return readControlByte(byte);
+  }
+
+private:
+  DecodeResult readControlByte(char byte) {
+    // After a bad frame, skip to the start of the next one
+    if(m_discarding) {
+      if(byte == 0) {
+        m_discarding = false;
+      }
+      return { CobsDecodeState::NotReady, 0, nullptr };
+    }
+
     *m_readPos = byte;
     size_t length = (m_readPos - m_readBuffer) + 1;
     if(byte == 0) {
-      m_readPos = m_readBuffer;
-      return decodeFrame(length);
+      stats().trace(TraceEvent::Delimiter, 0);
+      auto status = checkFrame(length);
+      DecodeResult result = { status, 0, nullptr };
+      if(status == CobsDecodeState::Decoded) {
+        result = decodeFrame(length);
+      }
+      resetFrame();
+      stats().frameReceived(result.status, length);
+      BAKELITE_PROBE2(frame_decoded, length, (int)result.status);
+      return result;
     }
     else if(length == sizeof(m_readBuffer)) {
-      m_readPos = m_readBuffer;
+      resetFrame();
+      m_discarding = true;
+      stats().frameReceived(CobsDecodeState::BufferOverrun, length);
+      BAKELITE_PROBE1(buffer_overrun, length);
       return { CobsDecodeState::BufferOverrun, 0, nullptr };
     }
 
+    // Follow the chain of COBS code bytes as they arrive, so a bad
+    // frame is caught at its delimiter without decoding it
+    uint8_t code = (uint8_t)byte;
+    if(length == 1) {
+      stats().trace(TraceEvent::FrameStart, 0);
+    }
+    else if(m_lastCode != 0xFF) {
+      m_decodedLength++;
+    }
+    m_decodedLength += code - 1;
+    m_lastCode = code;
+    m_nextCode += code;
+
+    // The next code can't fit in the buffer
+    if(m_nextCode >= sizeof(m_readBuffer)) {
+      resetFrame();
+      m_discarding = true;
+      stats().frameReceived(CobsDecodeState::DecodeFailure, length);
+      return { CobsDecodeState::DecodeFailure, 0, nullptr };
+    }
+
     m_readPos++;
     return { CobsDecodeState::NotReady, 0, nullptr };
   }
 
-private:
-  DecodeResult decodeFrame(size_t length) {
-    if(length == 1) {
-      return { CobsDecodeState::DecodeFailure, 0, nullptr }; 
+  void resetFrame() {
+    m_readPos = m_readBuffer;
+    m_nextCode = 0;
+    m_lastCode = 0;
+    m_decodedLength = 0;
+  }
+
+  // Cheap checks before decoding, returns Decoded if the frame is worth
+  // decoding and checking the CRC of
+  CobsDecodeState checkFrame(size_t length) {
+    // The last code byte must point at the delimiter
+    if(length == 1 || m_nextCode != length - 1 || m_decodedLength < C::size()) {
+      return CobsDecodeState::DecodeFailure;
+    }
+
+    size_t dataLength = m_decodedLength - C::size();
+    if(m_filter != nullptr && dataLength > 0) {
+      // The first data byte is 0 when it's encoded as a code of 1
+      uint8_t id = m_readBuffer[0] == 1 ? 0 : (uint8_t)m_readBuffer[1];
+      if(!(*m_filter)(id, dataLength)) {
+        return CobsDecodeState::Rejected;
+      }
     }
+    return CobsDecodeState::Decoded;
+  }
 
+  DecodeResult decodeFrame(size_t length) {
     length--; // Discard null byte
 
     auto result = cobs_decode((void *)m_readBuffer, sizeof(m_readBuffer), (void *)m_readBuffer, length);
     if(result.status != 0) {
       return { CobsDecodeState::DecodeFailure, 0, nullptr };
     }
+    stats().trace(TraceEvent::Decoded, 0);
 
     // length of the decoded data without CRC
     length = result.out_len - C::size();
 
+    C crc;
     if(C::size() > 0) {
-      C crc;
-
       // Get the CRC from the end of the frame
       auto crc_val = crc.value();
       memcpy(&crc_val, m_readBuffer + length, sizeof(crc_val));
+      crc_val = toLittleEndian(crc_val);
 
       crc.update(m_readBuffer, length);
       if(crc_val != crc.value()) {
+        BAKELITE_PROBE2(crc_failure, length, (uint32_t)crc_val);
         return { CobsDecodeState::CrcFailure, 0, nullptr };
       }
     }
+    stats().trace(TraceEvent::CrcChecked, 0);
 
-    return { CobsDecodeState::Decoded, length, m_readBuffer };
+    return { CobsDecodeState::Decoded, length, m_readBuffer, (uint32_t)crc.value() };
   }
 
   constexpr static size_t cobsOverhead(size_t bufferSize) {
@@ -123,6 +222,11 @@ private:
 
   char m_readBuffer[BufferSize + overhead(BufferSize)];
   char *m_readPos = m_readBuffer;
+  bool m_discarding = false;
+  size_t m_nextCode = 0;
+  uint8_t m_lastCode = 0;
+  size_t m_decodedLength = 0;
+  FrameFilter m_filter = nullptr;
   char m_writeBuffer[BufferSize + overhead(BufferSize)];
   char *m_writePtr = m_writeBuffer + cobsOverhead(BufferSize);
 };
@@ -10,6 +10,17 @@ public:
 
   void update(const char *c, size_t length) {
   }
+
+  static int combine(int first, int second, uint64_t secondLength) {
+    return 0;
+  }
+
+  static int removePrefix(int prefix, int whole, uint64_t suffixLength) {
+    return 0;
+  }
+
+  void append(int next, uint64_t length) {
+  }
 };
 
 template <typename CrcFunc, typename CrcType>
@@ -27,34 +38,37 @@ public:
     CrcFunc fn;
     m_lastVal = fn(data, length, m_lastVal);
   }
-private:
-  CrcType m_lastVal = 0;
-};
-
-struct crc8_fn;
-struct crc16_fn;
-struct crc32_fn;
 
+  // Returns the CRC of two adjacent segments, from the CRC of each
+  // segment on its own, in O(log secondLength) without the data.
+  static CrcType combine(CrcType first, CrcType second, uint64_t secondLength) {
+    return CrcFunc::combine(first, second, secondLength);
+  }
 
-using Crc8 = Crc<crc8_fn, uint8_t>;
-using Crc16 = Crc<crc16_fn, uint16_t>;
-using Crc32 = Crc<crc32_fn, uint32_t>;
+  // The inverse of combine, returns the CRC of the suffix of a segment
+  static CrcType removePrefix(CrcType prefix, CrcType whole, uint64_t suffixLength) {
+    return CrcFunc::removePrefix(prefix, whole, suffixLength);
+  }
 
-/*
-  *  Auto generated CRC functions
-  */
+  // Appends the CRC of the length bytes that follow, computed on its own
+  void append(CrcType next, uint64_t length) {
+    m_lastVal = combine(m_lastVal, next, length);
+  }
+private:
+  CrcType m_lastVal = CrcFunc::initial();
+};
 
 // The CRC lookup tables are stored as const variables. On many platforms,
 // const variables are stored in flash memroy. On AVR though, they are
 // loaded into RAM on startup. A special PROGMEM macro is available on AVRs
 // to indicate constants should be stored in program memory (flash).
-// So if this macro is available, use it and assume we're on an AVR. 
+// So if this macro is available, use it and assume we're on an AVR.
 #ifdef PROGMEM
   #define BAKELITE_CONST PROGMEM
   // PROGMEM variables need to be accessed using pgm_read_* functions.
   #define BAKELITE_CONST_8(x)  pgm_read_byte(&(x))
-  #define BAKELITE_CONST_16(x) pgm_read_dword(&(x))
-  #define BAKELITE_CONST_32(x) ((uint32_t)pgm_read_dword((char *)&(x) + 2) << 16 | pgm_read_dword(&(x)))
+  #define BAKELITE_CONST_16(x) pgm_read_word(&(x))
+  #define BAKELITE_CONST_32(x) pgm_read_dword(&(x))
 #else
   #define BAKELITE_CONST
   #define BAKELITE_CONST_8(x)  x
@@ -62,189 +76,525 @@ using Crc32 = Crc<crc32_fn, uint32_t>;
   #define BAKELITE_CONST_32(x) x
 #endif
 
-// Automatically generated CRC function
-// polynomial: 0x107
-struct crc8_fn {
-  uint8_t operator()(const char *data, int len, uint8_t crc) {
-    const unsigned char *uData = (unsigned char *)data;
-
-    static const uint8_t table[256] BAKELITE_CONST = {
-    0x00U,0x07U,0x0EU,0x09U,0x1CU,0x1BU,0x12U,0x15U,
-    0x38U,0x3FU,0x36U,0x31U,0x24U,0x23U,0x2AU,0x2DU,
-    0x70U,0x77U,0x7EU,0x79U,0x6CU,0x6BU,0x62U,0x65U,
-    0x48U,0x4FU,0x46U,0x41U,0x54U,0x53U,0x5AU,0x5DU,
-    0xE0U,0xE7U,0xEEU,0xE9U,0xFCU,0xFBU,0xF2U,0xF5U,
-    0xD8U,0xDFU,0xD6U,0xD1U,0xC4U,0xC3U,0xCAU,0xCDU,
-    0x90U,0x97U,0x9EU,0x99U,0x8CU,0x8BU,0x82U,0x85U,
-    0xA8U,0xAFU,0xA6U,0xA1U,0xB4U,0xB3U,0xBAU,0xBDU,
-    0xC7U,0xC0U,0xC9U,0xCEU,0xDBU,0xDCU,0xD5U,0xD2U,
-    0xFFU,0xF8U,0xF1U,0xF6U,0xE3U,0xE4U,0xEDU,0xEAU,
-    0xB7U,0xB0U,0xB9U,0xBEU,0xABU,0xACU,0xA5U,0xA2U,
-    0x8FU,0x88U,0x81U,0x86U,0x93U,0x94U,0x9DU,0x9AU,
-    0x27U,0x20U,0x29U,0x2EU,0x3BU,0x3CU,0x35U,0x32U,
-    0x1FU,0x18U,0x11U,0x16U,0x03U,0x04U,0x0DU,0x0AU,
-    0x57U,0x50U,0x59U,0x5EU,0x4BU,0x4CU,0x45U,0x42U,
-    0x6FU,0x68U,0x61U,0x66U,0x73U,0x74U,0x7DU,0x7AU,
-    0x89U,0x8EU,0x87U,0x80U,0x95U,0x92U,0x9BU,0x9CU,
-    0xB1U,0xB6U,0xBFU,0xB8U,0xADU,0xAAU,0xA3U,0xA4U,
-    0xF9U,0xFEU,0xF7U,0xF0U,0xE5U,0xE2U,0xEBU,0xECU,
-    0xC1U,0xC6U,0xCFU,0xC8U,0xDDU,0xDAU,0xD3U,0xD4U,
-    0x69U,0x6EU,0x67U,0x60U,0x75U,0x72U,0x7BU,0x7CU,
-    0x51U,0x56U,0x5FU,0x58U,0x4DU,0x4AU,0x43U,0x44U,
-    0x19U,0x1EU,0x17U,0x10U,0x05U,0x02U,0x0BU,0x0CU,
-    0x21U,0x26U,0x2FU,0x28U,0x3DU,0x3AU,0x33U,0x34U,
-    0x4EU,0x49U,0x40U,0x47U,0x52U,0x55U,0x5CU,0x5BU,
-    0x76U,0x71U,0x78U,0x7FU,0x6AU,0x6DU,0x64U,0x63U,
-    0x3EU,0x39U,0x30U,0x37U,0x22U,0x25U,0x2CU,0x2BU,
-    0x06U,0x01U,0x08U,0x0FU,0x1AU,0x1DU,0x14U,0x13U,
-    0xAEU,0xA9U,0xA0U,0xA7U,0xB2U,0xB5U,0xBCU,0xBBU,
-    0x96U,0x91U,0x98U,0x9FU,0x8AU,0x8DU,0x84U,0x83U,
-    0xDEU,0xD9U,0xD0U,0xD7U,0xC2U,0xC5U,0xCCU,0xCBU,
-    0xE6U,0xE1U,0xE8U,0xEFU,0xFAU,0xFDU,0xF4U,0xF3U,
-    };
-
-    while (len > 0)
-    {
-      crc = BAKELITE_CONST_8(table[*uData ^ (uint8_t)crc]);
+inline uint8_t crcTableValue(const uint8_t &value) {
+  return BAKELITE_CONST_8(value);
+}
+
+inline uint16_t crcTableValue(const uint16_t &value) {
+  return BAKELITE_CONST_16(value);
+}
+
+inline uint32_t crcTableValue(const uint32_t &value) {
+  return BAKELITE_CONST_32(value);
+}
+
+// The functions and tables below are C++11 constexpr, a single return
+// statement each, so the runtime still builds with -std=gnu++11 (the
+// Arduino AVR default). Recursion is always a tail call.
+
+template <typename T>
+constexpr T reflectBitsFrom(T value, T result, size_t bit) {
+  return bit == sizeof(T) * 8 ? result :
+    reflectBitsFrom(value, (T)((result << 1) | ((value >> bit) & 1)), bit + 1);
+}
+
+template <typename T>
+constexpr T reflectBits(T value) {
+  return reflectBitsFrom(value, (T)0, 0);
+}
+
+template <typename T, T Poly>
+struct CrcPoly {
+  static constexpr T topBit = (T)((T)1 << (sizeof(T) * 8 - 1));
+  static constexpr T reflected = reflectBits(Poly);
+};
+
+// Index lists, for filling tables with a pack expansion
+template <size_t... I>
+struct CrcIndices {};
+
+template <size_t N, size_t... I>
+struct CrcIndicesFor: CrcIndicesFor<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct CrcIndicesFor<0, I...> {
+  using type = CrcIndices<I...>;
+};
+
+// Shifts bits more bits into a CRC table entry
+template <typename T, T Poly, bool Reflect>
+constexpr T crcTableEntry(T crc, int bits) {
+  return bits == 0 ? crc : crcTableEntry<T, Poly, Reflect>(
+    Reflect ?
+      ((crc & 1) ? (T)((crc >> 1) ^ CrcPoly<T, Poly>::reflected) : (T)(crc >> 1)) :
+      ((crc & CrcPoly<T, Poly>::topBit) ? (T)((crc << 1) ^ Poly) : (T)(crc << 1)),
+    bits - 1);
+}
+
+// Lookup table for a byte at a time CRC, built at compile time.
+// Poly is given in normal (MSB first) form, even for reflected CRCs.
+template <typename T, T Poly, bool Reflect>
+struct CrcTable {
+  constexpr CrcTable(): CrcTable(typename CrcIndicesFor<256>::type()) {}
+
+  template <size_t... I>
+  constexpr CrcTable(CrcIndices<I...>):
+    values{ crcTableEntry<T, Poly, Reflect>(Reflect ? (T)I : (T)(I << (sizeof(T) * 8 - 8)), 8)... } {}
+
+  T values[256];
+};
+
+template <typename T, T Poly>
+constexpr T crcMultiplyFrom(T a, T b, T mask, T product) {
+  return mask == 0 ? product : crcMultiplyFrom<T, Poly>(
+    a,
+    (b & 1) ? (T)((b >> 1) ^ CrcPoly<T, Poly>::reflected) : (T)(b >> 1),
+    (T)(mask >> 1),
+    (a & mask) ? (T)(product ^ b) : product);
+}
+
+// Multiplies a and b modulo Poly, in the bit reflected form used by
+// reflected CRCs, where the top bit is x^0.
+template <typename T, T Poly>
+constexpr T crcMultiply(T a, T b) {
+  return crcMultiplyFrom<T, Poly>(a, b, CrcPoly<T, Poly>::topBit, (T)0);
+}
+
+template <typename T, T Poly>
+constexpr T crcXPowFrom(T result, T base, uint64_t n) {
+  return n == 0 ? result : crcXPowFrom<T, Poly>(
+    (n & 1) ? crcMultiply<T, Poly>(result, base) : result,
+    crcMultiply<T, Poly>(base, base),
+    n >> 1);
+}
+
+// x^n modulo Poly, in reflected form
+template <typename T, T Poly>
+constexpr T crcXPow(uint64_t n) {
+  return crcXPowFrom<T, Poly>(CrcPoly<T, Poly>::topBit, (T)(CrcPoly<T, Poly>::topBit >> 1), n);
+}
+
+// A table driven CRC, with parameters in the usual Rocksoft model form.
+// Calls can be chained, passing in the value returned by the last call,
+// starting from initial().
+template <typename T, T Poly, bool Reflect, T Init, T XorOut>
+struct CrcFn {
+  constexpr static T initial() {
+    return (T)(Init ^ XorOut);
+  }
+
+  T operator()(const char *data, size_t len, T crc) const {
+    constexpr size_t width = sizeof(T) * 8;
+    static constexpr CrcTable<T, Poly, Reflect> table BAKELITE_CONST {};
+    const unsigned char *uData = (const unsigned char *)data;
+
+    crc = (T)(crc ^ XorOut);
+    while(len > 0) {
+      if(Reflect) {
+        crc = crcTableValue(table.values[(uint8_t)(crc ^ *uData)]) ^ (T)(crc >> 8);
+      }
+      else {
+        crc = crcTableValue(table.values[(uint8_t)((crc >> (width - 8)) ^ *uData)]) ^ (T)(crc << 8);
+      }
       uData++;
       len--;
     }
-    return crc;
+    return (T)(crc ^ XorOut);
+  }
+
+  static T combine(T first, T second, uint64_t secondLength) {
+    T shift = crcXPow<T, Poly>(secondLength * 8);
+    T crc = (T)(first ^ initial());
+    if(Reflect) {
+      crc = crcMultiply<T, Poly>(shift, crc);
+    }
+    else {
+      crc = reflectBits(crcMultiply<T, Poly>(shift, reflectBits(crc)));
+    }
+    return (T)(crc ^ second);
+  }
+
+  // CRCs are linear, so removing a prefix is the same as adding it
+  static T removePrefix(T prefix, T whole, uint64_t suffixLength) {
+    return combine(prefix, whole, suffixLength);
   }
 };
 
-// Automatically generated CRC function
-// polynomial: 0x18005, bit reverse algorithm
-struct crc16_fn {
-  uint16_t operator()(const char *data, int len, uint16_t crc) {
-    const unsigned char *uData = (unsigned char *)data;
-
-    static const uint16_t table[256] BAKELITE_CONST = {
-    0x0000U,0xC0C1U,0xC181U,0x0140U,0xC301U,0x03C0U,0x0280U,0xC241U,
-    0xC601U,0x06C0U,0x0780U,0xC741U,0x0500U,0xC5C1U,0xC481U,0x0440U,
-    0xCC01U,0x0CC0U,0x0D80U,0xCD41U,0x0F00U,0xCFC1U,0xCE81U,0x0E40U,
-    0x0A00U,0xCAC1U,0xCB81U,0x0B40U,0xC901U,0x09C0U,0x0880U,0xC841U,
-    0xD801U,0x18C0U,0x1980U,0xD941U,0x1B00U,0xDBC1U,0xDA81U,0x1A40U,
-    0x1E00U,0xDEC1U,0xDF81U,0x1F40U,0xDD01U,0x1DC0U,0x1C80U,0xDC41U,
-    0x1400U,0xD4C1U,0xD581U,0x1540U,0xD701U,0x17C0U,0x1680U,0xD641U,
-    0xD201U,0x12C0U,0x1380U,0xD341U,0x1100U,0xD1C1U,0xD081U,0x1040U,
-    0xF001U,0x30C0U,0x3180U,0xF141U,0x3300U,0xF3C1U,0xF281U,0x3240U,
-    0x3600U,0xF6C1U,0xF781U,0x3740U,0xF501U,0x35C0U,0x3480U,0xF441U,
-    0x3C00U,0xFCC1U,0xFD81U,0x3D40U,0xFF01U,0x3FC0U,0x3E80U,0xFE41U,
-    0xFA01U,0x3AC0U,0x3B80U,0xFB41U,0x3900U,0xF9C1U,0xF881U,0x3840U,
-    0x2800U,0xE8C1U,0xE981U,0x2940U,0xEB01U,0x2BC0U,0x2A80U,0xEA41U,
-    0xEE01U,0x2EC0U,0x2F80U,0xEF41U,0x2D00U,0xEDC1U,0xEC81U,0x2C40U,
-    0xE401U,0x24C0U,0x2580U,0xE541U,0x2700U,0xE7C1U,0xE681U,0x2640U,
-    0x2200U,0xE2C1U,0xE381U,0x2340U,0xE101U,0x21C0U,0x2080U,0xE041U,
-    0xA001U,0x60C0U,0x6180U,0xA141U,0x6300U,0xA3C1U,0xA281U,0x6240U,
-    0x6600U,0xA6C1U,0xA781U,0x6740U,0xA501U,0x65C0U,0x6480U,0xA441U,
-    0x6C00U,0xACC1U,0xAD81U,0x6D40U,0xAF01U,0x6FC0U,0x6E80U,0xAE41U,
-    0xAA01U,0x6AC0U,0x6B80U,0xAB41U,0x6900U,0xA9C1U,0xA881U,0x6840U,
-    0x7800U,0xB8C1U,0xB981U,0x7940U,0xBB01U,0x7BC0U,0x7A80U,0xBA41U,
-    0xBE01U,0x7EC0U,0x7F80U,0xBF41U,0x7D00U,0xBDC1U,0xBC81U,0x7C40U,
-    0xB401U,0x74C0U,0x7580U,0xB541U,0x7700U,0xB7C1U,0xB681U,0x7640U,
-    0x7200U,0xB2C1U,0xB381U,0x7340U,0xB101U,0x71C0U,0x7080U,0xB041U,
-    0x5000U,0x90C1U,0x9181U,0x5140U,0x9301U,0x53C0U,0x5280U,0x9241U,
-    0x9601U,0x56C0U,0x5780U,0x9741U,0x5500U,0x95C1U,0x9481U,0x5440U,
-    0x9C01U,0x5CC0U,0x5D80U,0x9D41U,0x5F00U,0x9FC1U,0x9E81U,0x5E40U,
-    0x5A00U,0x9AC1U,0x9B81U,0x5B40U,0x9901U,0x59C0U,0x5880U,0x9841U,
-    0x8801U,0x48C0U,0x4980U,0x8941U,0x4B00U,0x8BC1U,0x8A81U,0x4A40U,
-    0x4E00U,0x8EC1U,0x8F81U,0x4F40U,0x8D01U,0x4DC0U,0x4C80U,0x8C41U,
-    0x4400U,0x84C1U,0x8581U,0x4540U,0x8701U,0x47C0U,0x4680U,0x8641U,
-    0x8201U,0x42C0U,0x4380U,0x8341U,0x4100U,0x81C1U,0x8081U,0x4040U,
-    };
-
-    while (len > 0)
-    {
-      crc = BAKELITE_CONST_16(table[*uData ^ (uint8_t)crc]) ^ (crc >> 8);
-      uData++;
-      len--;
+template <typename T>
+struct CrcShiftRow {
+  T values[256];
+};
+
+// Advances a reflected CRC register past Length zero bytes, a byte of
+// the register at a time.
+template <typename T, T Poly, size_t Length>
+struct CrcShiftTable {
+  constexpr CrcShiftTable():
+    CrcShiftTable(crcXPow<T, Poly>((uint64_t)Length * 8),
+                  typename CrcIndicesFor<sizeof(T)>::type(), typename CrcIndicesFor<256>::type()) {}
+
+  template <size_t... Row, size_t... Byte>
+  constexpr CrcShiftTable(T shift, CrcIndices<Row...>, CrcIndices<Byte...> bytes):
+    rows{ row<Row>(shift, bytes)... } {}
+
+  T apply(T crc) const {
+    T result = 0;
+    for(size_t i = 0; i < sizeof(T); i++) {
+      result ^= rows[i].values[(uint8_t)(crc >> (i * 8))];
     }
-    return crc;
+    return result;
+  }
+
+  CrcShiftRow<T> rows[sizeof(T)];
+
+private:
+  template <size_t Row, size_t... Byte>
+  static constexpr CrcShiftRow<T> row(T shift, CrcIndices<Byte...>) {
+    return { { crcMultiply<T, Poly>(shift, (T)((T)Byte << (Row * 8)))... } };
   }
 };
 
-// Automatically generated CRC function
-// polynomial: 0x104C11DB7, bit reverse algorithm
-struct crc32_fn {
-  uint32_t operator()(const char *data, int len, uint32_t crc) {
-    const unsigned char *uData = (unsigned char *)data;
-
-    static const uint32_t table[256] BAKELITE_CONST = {
-    0x00000000U,0x77073096U,0xEE0E612CU,0x990951BAU,
-    0x076DC419U,0x706AF48FU,0xE963A535U,0x9E6495A3U,
-    0x0EDB8832U,0x79DCB8A4U,0xE0D5E91EU,0x97D2D988U,
-    0x09B64C2BU,0x7EB17CBDU,0xE7B82D07U,0x90BF1D91U,
-    0x1DB71064U,0x6AB020F2U,0xF3B97148U,0x84BE41DEU,
-    0x1ADAD47DU,0x6DDDE4EBU,0xF4D4B551U,0x83D385C7U,
-    0x136C9856U,0x646BA8C0U,0xFD62F97AU,0x8A65C9ECU,
-    0x14015C4FU,0x63066CD9U,0xFA0F3D63U,0x8D080DF5U,
-    0x3B6E20C8U,0x4C69105EU,0xD56041E4U,0xA2677172U,
-    0x3C03E4D1U,0x4B04D447U,0xD20D85FDU,0xA50AB56BU,
-    0x35B5A8FAU,0x42B2986CU,0xDBBBC9D6U,0xACBCF940U,
-    0x32D86CE3U,0x45DF5C75U,0xDCD60DCFU,0xABD13D59U,
-    0x26D930ACU,0x51DE003AU,0xC8D75180U,0xBFD06116U,
-    0x21B4F4B5U,0x56B3C423U,0xCFBA9599U,0xB8BDA50FU,
-    0x2802B89EU,0x5F058808U,0xC60CD9B2U,0xB10BE924U,
-    0x2F6F7C87U,0x58684C11U,0xC1611DABU,0xB6662D3DU,
-    0x76DC4190U,0x01DB7106U,0x98D220BCU,0xEFD5102AU,
-    0x71B18589U,0x06B6B51FU,0x9FBFE4A5U,0xE8B8D433U,
-    0x7807C9A2U,0x0F00F934U,0x9609A88EU,0xE10E9818U,
-    0x7F6A0DBBU,0x086D3D2DU,0x91646C97U,0xE6635C01U,
-    0x6B6B51F4U,0x1C6C6162U,0x856530D8U,0xF262004EU,
-    0x6C0695EDU,0x1B01A57BU,0x8208F4C1U,0xF50FC457U,
-    0x65B0D9C6U,0x12B7E950U,0x8BBEB8EAU,0xFCB9887CU,
-    0x62DD1DDFU,0x15DA2D49U,0x8CD37CF3U,0xFBD44C65U,
-    0x4DB26158U,0x3AB551CEU,0xA3BC0074U,0xD4BB30E2U,
-    0x4ADFA541U,0x3DD895D7U,0xA4D1C46DU,0xD3D6F4FBU,
-    0x4369E96AU,0x346ED9FCU,0xAD678846U,0xDA60B8D0U,
-    0x44042D73U,0x33031DE5U,0xAA0A4C5FU,0xDD0D7CC9U,
-    0x5005713CU,0x270241AAU,0xBE0B1010U,0xC90C2086U,
-    0x5768B525U,0x206F85B3U,0xB966D409U,0xCE61E49FU,
-    0x5EDEF90EU,0x29D9C998U,0xB0D09822U,0xC7D7A8B4U,
-    0x59B33D17U,0x2EB40D81U,0xB7BD5C3BU,0xC0BA6CADU,
-    0xEDB88320U,0x9ABFB3B6U,0x03B6E20CU,0x74B1D29AU,
-    0xEAD54739U,0x9DD277AFU,0x04DB2615U,0x73DC1683U,
-    0xE3630B12U,0x94643B84U,0x0D6D6A3EU,0x7A6A5AA8U,
-    0xE40ECF0BU,0x9309FF9DU,0x0A00AE27U,0x7D079EB1U,
-    0xF00F9344U,0x8708A3D2U,0x1E01F268U,0x6906C2FEU,
-    0xF762575DU,0x806567CBU,0x196C3671U,0x6E6B06E7U,
-    0xFED41B76U,0x89D32BE0U,0x10DA7A5AU,0x67DD4ACCU,
-    0xF9B9DF6FU,0x8EBEEFF9U,0x17B7BE43U,0x60B08ED5U,
-    0xD6D6A3E8U,0xA1D1937EU,0x38D8C2C4U,0x4FDFF252U,
-    0xD1BB67F1U,0xA6BC5767U,0x3FB506DDU,0x48B2364BU,
-    0xD80D2BDAU,0xAF0A1B4CU,0x36034AF6U,0x41047A60U,
-    0xDF60EFC3U,0xA867DF55U,0x316E8EEFU,0x4669BE79U,
-    0xCB61B38CU,0xBC66831AU,0x256FD2A0U,0x5268E236U,
-    0xCC0C7795U,0xBB0B4703U,0x220216B9U,0x5505262FU,
-    0xC5BA3BBEU,0xB2BD0B28U,0x2BB45A92U,0x5CB36A04U,
-    0xC2D7FFA7U,0xB5D0CF31U,0x2CD99E8BU,0x5BDEAE1DU,
-    0x9B64C2B0U,0xEC63F226U,0x756AA39CU,0x026D930AU,
-    0x9C0906A9U,0xEB0E363FU,0x72076785U,0x05005713U,
-    0x95BF4A82U,0xE2B87A14U,0x7BB12BAEU,0x0CB61B38U,
-    0x92D28E9BU,0xE5D5BE0DU,0x7CDCEFB7U,0x0BDBDF21U,
-    0x86D3D2D4U,0xF1D4E242U,0x68DDB3F8U,0x1FDA836EU,
-    0x81BE16CDU,0xF6B9265BU,0x6FB077E1U,0x18B74777U,
-    0x88085AE6U,0xFF0F6A70U,0x66063BCAU,0x11010B5CU,
-    0x8F659EFFU,0xF862AE69U,0x616BFFD3U,0x166CCF45U,
-    0xA00AE278U,0xD70DD2EEU,0x4E048354U,0x3903B3C2U,
-    0xA7672661U,0xD06016F7U,0x4969474DU,0x3E6E77DBU,
-    0xAED16A4AU,0xD9D65ADCU,0x40DF0B66U,0x37D83BF0U,
-    0xA9BCAE53U,0xDEBB9EC5U,0x47B2CF7FU,0x30B5FFE9U,
-    0xBDBDF21CU,0xCABAC28AU,0x53B39330U,0x24B4A3A6U,
-    0xBAD03605U,0xCDD70693U,0x54DE5729U,0x23D967BFU,
-    0xB3667A2EU,0xC4614AB8U,0x5D681B02U,0x2A6F2B94U,
-    0xB40BBE37U,0xC30C8EA1U,0x5A05DF1BU,0x2D02EF8DU,
-    };
-
-    crc = crc ^ 0xFFFFFFFFU;
-    while (len > 0)
-    {
-      crc = BAKELITE_CONST_32(table[*uData ^ (uint8_t)crc]) ^ (crc >> 8);
-      uData++;
+#if defined(__SSE4_2__) || (defined(__ARM_FEATURE_CRC32) && !BAKELITE_BIG_ENDIAN)
+#define BAKELITE_HW_CRC32C 1
+#else
+#define BAKELITE_HW_CRC32C 0
+#endif
+
+#if BAKELITE_HW_CRC32C
+inline uint32_t crc32cByte(uint32_t crc, uint8_t value) {
+#if defined(__SSE4_2__)
+  return _mm_crc32_u8(crc, value);
+#else
+  return __crc32cb(crc, value);
+#endif
+}
+
+inline uint32_t crc32cWord(uint32_t crc, const char *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+#if defined(__SSE4_2__) && defined(__x86_64__)
+  return (uint32_t)_mm_crc32_u64(crc, value);
+#elif defined(__SSE4_2__)
+  crc = _mm_crc32_u32(crc, (uint32_t)value);
+  return _mm_crc32_u32(crc, (uint32_t)(value >> 32));
+#else
+  return __crc32cd(crc, value);
+#endif
+}
+
+// CRC-32C using the SSE4.2 or ARMv8 crc32c instructions. Large buffers
+// are split into three streams, so the instruction's latency is hidden,
+// then the streams are combined with shift tables.
+struct crc32c_hw_fn {
+  static constexpr uint32_t poly = 0x1EDC6F41;
+  static constexpr size_t longBlock = 8192;
+  static constexpr size_t shortBlock = 256;
+
+  constexpr static uint32_t initial() {
+    return 0;
+  }
+
+  uint32_t operator()(const char *data, size_t len, uint32_t crc) const {
+    crc = ~crc;
+    crc = threeWay<longBlock>(data, len, crc);
+    crc = threeWay<shortBlock>(data, len, crc);
+
+    while(len >= 8) {
+      crc = crc32cWord(crc, data);
+      data += 8;
+      len -= 8;
+    }
+    while(len > 0) {
+      crc = crc32cByte(crc, (uint8_t)*data);
+      data++;
       len--;
     }
-    crc = crc ^ 0xFFFFFFFFU;
+    return ~crc;
+  }
+
+  static uint32_t combine(uint32_t first, uint32_t second, uint64_t secondLength) {
+    return crcMultiply<uint32_t, poly>(crcXPow<uint32_t, poly>(secondLength * 8), first) ^ second;
+  }
+
+  static uint32_t removePrefix(uint32_t prefix, uint32_t whole, uint64_t suffixLength) {
+    return combine(prefix, whole, suffixLength);
+  }
+
+private:
+  template <size_t Block>
+  static uint32_t threeWay(const char *&data, size_t &len, uint32_t crc) {
+    static constexpr CrcShiftTable<uint32_t, poly, Block> shift {};
+
+    while(len >= Block * 3) {
+      uint32_t crc1 = 0;
+      uint32_t crc2 = 0;
+      const char *end = data + Block;
+      do {
+        crc = crc32cWord(crc, data);
+        crc1 = crc32cWord(crc1, data + Block);
+        crc2 = crc32cWord(crc2, data + Block * 2);
+        data += 8;
+      } while(data < end);
+
+      crc = shift.apply(crc) ^ crc1;
+      crc = shift.apply(crc) ^ crc2;
+      data += Block * 2;
+      len -= Block * 3;
+    }
     return crc;
   }
-};
\ No newline at end of file
+};
+#endif
+
+/*
+ * CRC catalog. To use another CRC, define it the same way, for example:
+ * using CrcKermit = Crc<CrcFn<uint16_t, 0x1021, true, 0, 0>, uint16_t>;
+ */
+
+// CRC-8/SMBUS
+using crc8_fn = CrcFn<uint8_t, 0x07, false, 0, 0>;
+// CRC-16/ARC
+using crc16_fn = CrcFn<uint16_t, 0x8005, true, 0, 0>;
+// CRC-16/CCITT-FALSE
+using crc16_ccitt_fn = CrcFn<uint16_t, 0x1021, false, 0xFFFF, 0>;
+// CRC-32, as used by zlib and ethernet
+using crc32_fn = CrcFn<uint32_t, 0x04C11DB7, true, 0xFFFFFFFF, 0xFFFFFFFF>;
+// CRC-32C (Castagnoli), in hardware when available
+using crc32c_table_fn = CrcFn<uint32_t, 0x1EDC6F41, true, 0xFFFFFFFF, 0xFFFFFFFF>;
+#if BAKELITE_HW_CRC32C
+using crc32c_fn = crc32c_hw_fn;
+#else
+using crc32c_fn = crc32c_table_fn;
+#endif
+
+using Crc8 = Crc<crc8_fn, uint8_t>;
+using Crc16 = Crc<crc16_fn, uint16_t>;
+using Crc16Ccitt = Crc<crc16_ccitt_fn, uint16_t>;
+using Crc32 = Crc<crc32_fn, uint32_t>;
+using Crc32c = Crc<crc32c_fn, uint32_t>;
+
+
+/*
+ * Checksums
+ *
+ * Fletcher and Adler checksums don't need lookup tables, and take a
+ * fraction of the cycles of a table CRC on 8-bit MCUs, at the cost of
+ * weaker error detection. They can be used anywhere a Crc can.
+ */
+
+// Sums are reduced every Block words, as late as possible without
+// overflowing. AVRs use 16-bit sums for Fletcher-16, to keep the inner
+// loop in 8-bit registers.
+#ifdef __AVR__
+using Fletcher16Sum = uint16_t;
+constexpr size_t fletcher16Block = 20;
+#else
+using Fletcher16Sum = uint32_t;
+constexpr size_t fletcher16Block = 5802;
+#endif
+constexpr size_t fletcher32Block = 359;
+constexpr size_t adler32Block = 5552;
+
+// On hosts, 8 bytes are added per step: sum2 gains 8 * sum1 plus the
+// bytes weighted by position, the same result as 8 single byte steps
+// without the dependency between them.
+template <typename S, S Mod, size_t Block>
+void fletcherSums(const unsigned char *data, size_t len, S &sum1, S &sum2) {
+  while(len > 0) {
+    size_t count = len < Block ? len : Block;
+    len -= count;
+#ifndef __AVR__
+    for(; count >= 8; count -= 8) {
+      sum2 += 8 * sum1 + 8 * data[0] + 7 * data[1] + 6 * data[2] + 5 * data[3] +
+              4 * data[4] + 3 * data[5] + 2 * data[6] + data[7];
+      sum1 += (S)data[0] + data[1] + data[2] + data[3] + data[4] + data[5] + data[6] + data[7];
+      data += 8;
+    }
+#endif
+    for(; count > 0; count--) {
+      sum1 += *data++;
+      sum2 += sum1;
+    }
+    sum1 %= Mod;
+    sum2 %= Mod;
+  }
+}
+
+// Fletcher-16, the check value is (sum2 << 8) | sum1
+struct fletcher16_fn {
+  constexpr static uint16_t initial() {
+    return 0;
+  }
+
+  uint16_t operator()(const char *data, size_t len, uint16_t value) const {
+    Fletcher16Sum sum1 = value & 0xFF;
+    Fletcher16Sum sum2 = value >> 8;
+    fletcherSums<Fletcher16Sum, 255, fletcher16Block>((const unsigned char *)data, len, sum1, sum2);
+    return (uint16_t)((sum2 << 8) | sum1);
+  }
+
+  static uint16_t combine(uint16_t first, uint16_t second, uint64_t secondLength) {
+    uint32_t sum1 = (first & 0xFF) + (second & 0xFF);
+    uint32_t sum2 = (first >> 8) + (second >> 8) + (uint32_t)(secondLength % 255) * (first & 0xFF);
+    return (uint16_t)(((sum2 % 255) << 8) | (sum1 % 255));
+  }
+
+  static uint16_t removePrefix(uint16_t prefix, uint16_t whole, uint64_t suffixLength) {
+    uint32_t sum1 = (whole & 0xFF) + 255 - (prefix & 0xFF);
+    uint32_t sum2 = (whole >> 8) + 255 - (prefix >> 8) + (uint32_t)(255 - suffixLength % 255) * (prefix & 0xFF);
+    return (uint16_t)(((sum2 % 255) << 8) | (sum1 % 255));
+  }
+};
+
+// Fletcher-32 over little endian 16-bit words. An odd trailing byte is
+// padded with zero, so chained updates must have even lengths.
+struct fletcher32_fn {
+  constexpr static uint32_t initial() {
+    return 0;
+  }
+
+  uint32_t operator()(const char *data, size_t len, uint32_t value) const {
+    const unsigned char *uData = (const unsigned char *)data;
+    uint32_t sum1 = value & 0xFFFF;
+    uint32_t sum2 = value >> 16;
+    size_t words = len / 2;
+
+    while(words > 0) {
+      size_t count = words < fletcher32Block ? words : fletcher32Block;
+      words -= count;
+#ifndef __AVR__
+      for(; count >= 4; count -= 4) {
+        uint32_t w0 = word(uData);
+        uint32_t w1 = word(uData + 2);
+        uint32_t w2 = word(uData + 4);
+        uint32_t w3 = word(uData + 6);
+        sum2 += 4 * sum1 + 4 * w0 + 3 * w1 + 2 * w2 + w3;
+        sum1 += w0 + w1 + w2 + w3;
+        uData += 8;
+      }
+#endif
+      for(; count > 0; count--) {
+        sum1 += word(uData);
+        sum2 += sum1;
+        uData += 2;
+      }
+      sum1 %= 65535;
+      sum2 %= 65535;
+    }
+
+    if(len & 1) {
+      sum1 = (sum1 + *uData) % 65535;
+      sum2 = (sum2 + sum1) % 65535;
+    }
+    return (sum2 << 16) | sum1;
+  }
+
+  // The first segment must have an even length
+  static uint32_t combine(uint32_t first, uint32_t second, uint64_t secondLength) {
+    uint64_t words = ((secondLength + 1) / 2) % 65535;
+    uint64_t sum1 = (first & 0xFFFF) + (second & 0xFFFF);
+    uint64_t sum2 = (first >> 16) + (second >> 16) + words * (first & 0xFFFF);
+    return (uint32_t)(((sum2 % 65535) << 16) | (sum1 % 65535));
+  }
+
+  static uint32_t removePrefix(uint32_t prefix, uint32_t whole, uint64_t suffixLength) {
+    uint64_t words = ((suffixLength + 1) / 2) % 65535;
+    uint64_t sum1 = (whole & 0xFFFF) + 65535 - (prefix & 0xFFFF);
+    uint64_t sum2 = (whole >> 16) + 65535 - (prefix >> 16) + (65535 - words) * (prefix & 0xFFFF);
+    return (uint32_t)(((sum2 % 65535) << 16) | (sum1 % 65535));
+  }
+
+private:
+  static uint32_t word(const unsigned char *data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8);
+  }
+};
+
+// Adler-32, as used by zlib
+struct adler32_fn {
+  constexpr static uint32_t initial() {
+    return 1;
+  }
+
+  uint32_t operator()(const char *data, size_t len, uint32_t value) const {
+    uint32_t sum1 = value & 0xFFFF;
+    uint32_t sum2 = value >> 16;
+    fletcherSums<uint32_t, 65521, adler32Block>((const unsigned char *)data, len, sum1, sum2);
+    return (sum2 << 16) | sum1;
+  }
+
+  static uint32_t combine(uint32_t first, uint32_t second, uint64_t secondLength) {
+    uint64_t length = secondLength % 65521;
+    uint64_t sum1 = (first & 0xFFFF) + (second & 0xFFFF) + 65521 - 1;
+    uint64_t sum2 = (first >> 16) + (second >> 16) + length * (first & 0xFFFF) + 65521 - length;
+    return (uint32_t)(((sum2 % 65521) << 16) | (sum1 % 65521));
+  }
+
+  static uint32_t removePrefix(uint32_t prefix, uint32_t whole, uint64_t suffixLength) {
+    uint64_t length = suffixLength % 65521;
+    uint64_t sum1 = (whole & 0xFFFF) + 65521 - (prefix & 0xFFFF) + 1;
+    uint64_t sum2 = (whole >> 16) + 65521 - (prefix >> 16) + (65521 - length) * (prefix & 0xFFFF) + length;
+    return (uint32_t)(((sum2 % 65521) << 16) | (sum1 % 65521));
+  }
+};
+
+using Fletcher16 = Crc<fletcher16_fn, uint16_t>;
+using Fletcher32 = Crc<fletcher32_fn, uint32_t>;
+using Adler32 = Crc<adler32_fn, uint32_t>;
+
+// Segments can only be combined if every segment but the last is a
+// multiple of this long. Fletcher-32 sums 16 bit words.
+template <class C>
+struct CrcAlignment {
+  static constexpr size_t value = 1;
+};
+
+template <>
+struct CrcAlignment<Fletcher32> {
+  static constexpr size_t value = 2;
+};
+
+#ifdef BAKELITE_HOST_TOOLS
+// Computes the CRC of a large buffer on several threads, then combines
+// the CRCs of each thread's segment. Threads defaults to the number of
+// hardware threads.
+template <class C>
+auto parallelCrc(const char *data, size_t length, unsigned threads = 0) -> decltype(C().value()) {
+  using Value = decltype(C().value());
+  constexpr size_t minSegment = 1 << 16;
+
+  if(threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if(threads > length / minSegment) {
+    threads = (unsigned)(length / minSegment);
+  }
+  if(threads <= 1) {
+    C crc;
+    crc.update(data, length);
+    return crc.value();
+  }
+
+  size_t segment = length / threads;
+  segment -= segment % CrcAlignment<C>::value;
+  std::vector<Value> values(threads);
+  std::vector<std::thread> workers;
+  for(unsigned i = 0; i < threads; i++) {
+    size_t start = segment * i;
+    size_t end = i == threads - 1 ? length : start + segment;
+    workers.emplace_back([=, &values]() {
+      C crc;
+      crc.update(data + start, end - start);
+      values[i] = crc.value();
+    });
+  }
+
+  C crc;
+  for(unsigned i = 0; i < threads; i++) {
+    workers[i].join();
+    size_t end = i == threads - 1 ? length : segment * (i + 1);
+    crc.append(values[i], end - segment * i);
+  }
+  return crc.value();
+}
+#endif
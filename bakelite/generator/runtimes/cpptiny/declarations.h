@@ -8,4 +8,16 @@ struct cobs_decode_result
 static cobs_encode_result cobs_encode(void *dst_buf_ptr, size_t dst_buf_len,
                                 const void *src_ptr, size_t src_len);
 static cobs_decode_result cobs_decode(void *dst_buf_ptr, size_t dst_buf_len,
-                                const void *src_ptr, size_t src_len);
\ No newline at end of file
+                                const void *src_ptr, size_t src_len);
+
+enum class CobsDecodeState {
+  Decoded,
+  NotReady,
+  DecodeFailure,
+  CrcFailure,
+  BufferOverrun,
+  Rejected,
+};
+
+// A monotonic clock, such as millis or micros on Arduino
+using ClockFn = unsigned long (*)();
@@ -0,0 +1,193 @@
+/*
+ * Parallel stream decoding
+ *
+ * StreamDecoder decodes a large recorded COBS stream, such as a raw
+ * capture of a serial port, on all cores. Since 0 only appears as a
+ * delimiter, the stream can be cut anywhere and picked up again at the
+ * next delimiter. The stream is decoded in batches, and each batch is cut
+ * into slices that the threads take from a shared counter, so a thread
+ * that finishes early takes more of the work. Frames belong to the slice
+ * their delimiter is in.
+ *
+ * Threads search for delimiters with memchr, which the C library
+ * vectorizes.
+ */
+#ifdef BAKELITE_HOST_TOOLS
+
+// A frame from a stream
+struct StreamFrame {
+  // Where the frame starts in the stream, and its length there,
+  // including the delimiter
+  size_t offset;
+  size_t encodedLength;
+  // Decoded, DecodeFailure or CrcFailure
+  CobsDecodeState status;
+  // The frame without its CRC, if it was decoded. data is valid until
+  // the frame is delivered.
+  const char *data;
+  size_t length;
+};
+
+template <class C>
+class StreamDecoder {
+public:
+  // threads defaults to the number of hardware threads. batchSize is
+  // roughly how much of the stream is decoded before frames are
+  // delivered, and sliceSize how much a thread takes at a time.
+  explicit StreamDecoder(unsigned threads = 0, size_t batchSize = 16 << 20, size_t sliceSize = 256 << 10):
+    m_threads(threads > 0 ? threads : std::thread::hardware_concurrency()),
+    m_batchSize(batchSize > 0 ? batchSize : 1),
+    m_sliceSize(sliceSize > 0 ? sliceSize : 1)
+  {
+    if(m_threads == 0) {
+      m_threads = 1;
+    }
+  }
+
+  // Decodes every frame in data. work(const StreamFrame &) is called for
+  // each decoded frame, on any thread, and returns a result, for example
+  // the unpacked message. deliver(const StreamFrame &, Result &) is then
+  // called on this thread for every frame, in stream order, including
+  // frames that failed to decode, whose result is default constructed.
+  // Empty frames (repeated delimiters) are skipped.
+  //
+  // Returns how much of data was decoded, up to and including the last
+  // delimiter. The rest is an incomplete frame.
+  template <class Work, class Deliver>
+  size_t decode(const char *data, size_t length, Work work, Deliver deliver) {
+    using Result = decltype(work(std::declval<const StreamFrame &>()));
+
+    std::vector<char> buffer;
+    size_t pos = 0;
+    while(pos < length) {
+      size_t end = batchEnd(data, pos, length);
+      if(end == pos) {
+        break;
+      }
+      decodeBatch<Result>(data, pos, end, buffer, work, deliver);
+      pos = end;
+    }
+    return pos;
+  }
+
+private:
+  template <class Result>
+  struct Decoded {
+    StreamFrame frame;
+    Result result;
+  };
+
+  // The end of a batch, just past a delimiter, or start if there isn't a
+  // complete frame
+  size_t batchEnd(const char *data, size_t start, size_t length) const {
+    size_t end = length - start > m_batchSize ? start + m_batchSize : length;
+    for(size_t i = end; i > start; i--) {
+      if(data[i - 1] == 0) {
+        return i;
+      }
+    }
+
+    // A frame longer than a batch
+    auto delimiter = (const char *)memchr(data + end, 0, length - end);
+    return delimiter != nullptr ? (size_t)(delimiter - data) + 1 : start;
+  }
+
+  template <class Result, class Work, class Deliver>
+  void decodeBatch(const char *data, size_t start, size_t end,
+                   std::vector<char> &buffer, Work &work, Deliver &deliver) {
+    size_t slices = (end - start + m_sliceSize - 1) / m_sliceSize;
+    std::vector<std::vector<Decoded<Result>>> results(slices);
+    buffer.resize(end - start);
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      for(size_t slice = next++; slice < slices; slice = next++) {
+        size_t sliceStart = start + slice * m_sliceSize;
+        size_t sliceEnd = end - sliceStart > m_sliceSize ? sliceStart + m_sliceSize : end;
+        decodeSlice(data, start, sliceStart, sliceEnd, buffer.data(), results[slice], work);
+      }
+    };
+
+    unsigned threads = slices < m_threads ? (unsigned)slices : m_threads;
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < threads; i++) {
+      workers.emplace_back(worker);
+    }
+    worker();
+    for(auto &thread : workers) {
+      thread.join();
+    }
+
+    for(auto &slice : results) {
+      for(auto &decoded : slice) {
+        deliver((const StreamFrame &)decoded.frame, decoded.result);
+      }
+    }
+  }
+
+  // Decodes the frames whose delimiters are in [sliceStart, sliceEnd).
+  // Each frame is decoded into output at its offset from the batch start,
+  // since a decoded frame is never longer than it was on the wire.
+  template <class Result, class Work>
+  static void decodeSlice(const char *data, size_t batchStart, size_t sliceStart, size_t sliceEnd,
+                          char *output, std::vector<Decoded<Result>> &results, Work &work) {
+    // The first frame starts after the last delimiter before the slice
+    size_t frameStart = sliceStart;
+    while(frameStart > batchStart && data[frameStart - 1] != 0) {
+      frameStart--;
+    }
+
+    size_t pos = sliceStart;
+    while(pos < sliceEnd) {
+      auto delimiter = (const char *)memchr(data + pos, 0, sliceEnd - pos);
+      if(delimiter == nullptr) {
+        break;
+      }
+      size_t frameEnd = (size_t)(delimiter - data);
+      pos = frameEnd + 1;
+
+      size_t encodedLength = frameEnd - frameStart;
+      if(encodedLength > 0) {
+        Decoded<Result> decoded = { decodeFrame(data, frameStart, encodedLength, output + (frameStart - batchStart)), Result() };
+        if(decoded.frame.status == CobsDecodeState::Decoded) {
+          decoded.result = work((const StreamFrame &)decoded.frame);
+        }
+        results.push_back(std::move(decoded));
+      }
+      frameStart = pos;
+    }
+  }
+
+  static StreamFrame decodeFrame(const char *data, size_t offset, size_t length, char *output) {
+    StreamFrame frame = { offset, length + 1, CobsDecodeState::DecodeFailure, nullptr, 0 };
+
+    auto result = cobs_decode(output, length, data + offset, length);
+    if(result.status != 0 || result.out_len < C::size()) {
+      return frame;
+    }
+
+    size_t dataLength = result.out_len - C::size();
+    C crc;
+    if(C::size() > 0) {
+      auto crc_val = crc.value();
+      memcpy(&crc_val, output + dataLength, sizeof(crc_val));
+      crc_val = toLittleEndian(crc_val);
+
+      crc.update(output, dataLength);
+      if(crc_val != crc.value()) {
+        frame.status = CobsDecodeState::CrcFailure;
+        return frame;
+      }
+    }
+
+    frame.status = CobsDecodeState::Decoded;
+    frame.data = output;
+    frame.length = dataLength;
+    return frame;
+  }
+
+  unsigned m_threads;
+  size_t m_batchSize;
+  size_t m_sliceSize;
+};
+#endif
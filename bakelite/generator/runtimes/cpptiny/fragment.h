@@ -0,0 +1,245 @@
+/*
+ * Fragmentation
+ *
+ * Messages too large for one frame are split into fragments, each sent
+ * in its own frame with the reserved message ID 0:
+ *
+ *   [0] [message ID] [transfer] [index: uint16] [data...]
+ *
+ * The transfer number changes with every fragmented message, and the
+ * high bit of the index marks the last fragment. Fragments must arrive
+ * in order, if one is lost the whole message is dropped.
+ */
+
+constexpr size_t fragmentHeaderSize = 5;
+constexpr uint16_t fragmentLastFlag = 0x8000;
+constexpr uint16_t fragmentMaxIndex = 0x7fff;
+
+enum class FragmentStatus {
+  Incomplete,
+  Complete,
+  Dropped,
+};
+
+// Packs a message straight into fragments, using the framer's write
+// buffer. Full fragments are only sent once more data arrives, so the
+// last one can be flagged by finish().
+template <class F, class W>
+class FragmentWriter {
+public:
+  FragmentWriter(F &framer, W writeFn, uint8_t messageId, uint8_t transfer):
+    m_framer(framer),
+    m_writeFn(writeFn),
+    m_messageId(messageId),
+    m_transfer(transfer)
+  {}
+
+  int write(const char *data, uint32_t length) {
+    while(length > 0) {
+      if(m_pos == capacity()) {
+        int rcode = sendFragment(false);
+        if(rcode != 0)
+          return rcode;
+      }
+
+      uint32_t count = capacity() - m_pos;
+      if(count > length) {
+        count = length;
+      }
+      memcpy(m_framer.writeBuffer() + fragmentHeaderSize + m_pos, data, count);
+      m_pos += count;
+      m_length += count;
+      data += count;
+      length -= count;
+    }
+    return 0;
+  }
+
+  int finish() {
+    return sendFragment(true);
+  }
+
+  // Total bytes written
+  size_t pos() const {
+    return m_length;
+  }
+
+private:
+  size_t capacity() const {
+    return m_framer.writeBufferSize() - fragmentHeaderSize;
+  }
+
+  int sendFragment(bool last) {
+    if(m_index > fragmentMaxIndex) {
+      return -1;
+    }
+
+    char *header = m_framer.writeBuffer();
+    uint16_t index = toLittleEndian((uint16_t)(m_index | (last ? fragmentLastFlag : 0)));
+    header[0] = 0;
+    header[1] = (char)m_messageId;
+    header[2] = (char)m_transfer;
+    memcpy(header + 3, &index, sizeof(index));
+
+    auto result = m_framer.encodeFrame(fragmentHeaderSize + m_pos);
+    if(result.status != 0) {
+      return result.status;
+    }
+
+    size_t ret = (*m_writeFn)((const char *)result.data, result.length);
+    if(ret != result.length) {
+      return -1;
+    }
+
+    m_index++;
+    m_pos = 0;
+    return 0;
+  }
+
+  F &m_framer;
+  W m_writeFn;
+  uint8_t m_messageId;
+  uint8_t m_transfer;
+  uint16_t m_index = 0;
+  size_t m_pos = 0;
+  size_t m_length = 0;
+};
+
+// Reassembles fragments into a caller provided buffer
+class FragmentAssembler {
+public:
+  struct Result {
+    FragmentStatus status;
+    uint8_t messageId;
+    size_t length;
+    char *data;
+  };
+
+  void setBuffer(char *buffer, size_t size) {
+    m_buffer = buffer;
+    m_size = size;
+    m_active = false;
+  }
+
+  // A partial message is dropped if no fragment arrives for timeout
+  // ticks of clock. Without a clock, partial messages never expire.
+  void setTimeout(ClockFn clock, unsigned long timeout) {
+    m_clock = clock;
+    m_timeout = timeout;
+  }
+
+  bool active() const {
+    return m_active;
+  }
+
+  // Returns true if a partial message was dropped
+  bool checkTimeout() {
+    if(m_active && m_clock != nullptr && (*m_clock)() - m_lastFragment > m_timeout) {
+      m_active = false;
+      return true;
+    }
+    return false;
+  }
+
+  // Data is a fragment frame, without the leading 0 message ID
+  Result addFragment(const char *data, size_t length) {
+    if(length < fragmentHeaderSize - 1) {
+      return drop();
+    }
+
+    uint8_t messageId = (uint8_t)data[0];
+    uint8_t transfer = (uint8_t)data[1];
+    uint16_t index;
+    memcpy(&index, data + 2, sizeof(index));
+    index = toLittleEndian(index);
+
+    bool last = (index & fragmentLastFlag) != 0;
+    index &= fragmentMaxIndex;
+    data += fragmentHeaderSize - 1;
+    length -= fragmentHeaderSize - 1;
+
+    if(index == 0) {
+      m_active = true;
+      m_messageId = messageId;
+      m_transfer = transfer;
+      m_next = 0;
+      m_pos = 0;
+    }
+
+    if(!m_active || messageId != m_messageId || transfer != m_transfer || index != m_next) {
+      return drop();
+    }
+
+    if(m_buffer == nullptr || length > m_size - m_pos) {
+      return drop();
+    }
+
+    memcpy(m_buffer + m_pos, data, length);
+    m_pos += length;
+    m_next++;
+    if(m_clock != nullptr) {
+      m_lastFragment = (*m_clock)();
+    }
+
+    if(last) {
+      m_active = false;
+      return { FragmentStatus::Complete, m_messageId, m_pos, m_buffer };
+    }
+    return { FragmentStatus::Incomplete, 0, 0, nullptr };
+  }
+
+private:
+  Result drop() {
+    m_active = false;
+    return { FragmentStatus::Dropped, 0, 0, nullptr };
+  }
+
+  char *m_buffer = nullptr;
+  size_t m_size = 0;
+  size_t m_pos = 0;
+
+  bool m_active = false;
+  uint8_t m_messageId = 0;
+  uint8_t m_transfer = 0;
+  uint16_t m_next = 0;
+
+  ClockFn m_clock = nullptr;
+  unsigned long m_timeout = 0;
+  unsigned long m_lastFragment = 0;
+};
+
+// Builds the CRC of a fragmented message's data from the CRCs of its
+// fragment frames, which the framer has already computed, so the data
+// isn't read again. C is the framer's CRC type, Fletcher-32 is not supported
+// since fragment headers have an odd length.
+template <class C>
+class FragmentCrc {
+  static_assert(fragmentHeaderSize % CrcAlignment<C>::value == 0,
+                "FragmentCrc doesn't support Fletcher-32, fragment headers have an odd length");
+
+public:
+  void reset() {
+    m_crc = C();
+  }
+
+  // frame is the whole fragment frame, including the 0 message ID, and
+  // frameCrc is its CRC from the framer's result
+  void addFragment(const char *frame, size_t length, uint32_t frameCrc) {
+    if(length < fragmentHeaderSize) {
+      return;
+    }
+
+    C header;
+    header.update(frame, fragmentHeaderSize);
+    size_t dataLength = length - fragmentHeaderSize;
+    auto dataCrc = C::removePrefix(header.value(), (decltype(header.value()))frameCrc, dataLength);
+    m_crc.append(dataCrc, dataLength);
+  }
+
+  auto value() const -> decltype(C().value()) {
+    return m_crc.value();
+  }
+
+private:
+  C m_crc;
+};
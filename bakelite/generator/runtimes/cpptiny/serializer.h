@@ -8,6 +8,126 @@ struct SizedArray {
   }
 };
 
+// Worst case sizes, as returned by the generated maxPackedSize() and
+// maxHeapSize(). Sizes saturate at unboundedSize, which is used for
+// values without an upper bound, like null terminated strings.
+constexpr uint32_t unboundedSize = 0xFFFFFFFF;
+
+constexpr uint32_t addSize(uint32_t a, uint32_t b) {
+  return (uint64_t)a + b >= unboundedSize ? unboundedSize : a + b;
+}
+
+constexpr uint32_t mulSize(uint32_t a, uint32_t b) {
+  return (uint64_t)a * b >= unboundedSize ? unboundedSize : a * b;
+}
+
+constexpr uint32_t maxSize(uint32_t a, uint32_t b) {
+  return a > b ? a : b;
+}
+
+// Integer types that are N bytes in size.
+// Used for wrapping arithmetic and bit manipulation of any
+// integer type, without relying on <type_traits>.
+template <size_t N> struct UIntOfSize;
+template <> struct UIntOfSize<1> { using type = uint8_t; };
+template <> struct UIntOfSize<2> { using type = uint16_t; };
+template <> struct UIntOfSize<4> { using type = uint32_t; };
+template <> struct UIntOfSize<8> { using type = uint64_t; };
+
+template <size_t N> struct IntOfSize;
+template <> struct IntOfSize<1> { using type = int8_t; };
+template <> struct IntOfSize<2> { using type = int16_t; };
+template <> struct IntOfSize<4> { using type = int32_t; };
+template <> struct IntOfSize<8> { using type = int64_t; };
+
+template <class V>
+constexpr bool isSigned() {
+  return (V)-1 < (V)0;
+}
+
+template <class V>
+constexpr V maxValue() {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  return isSigned<V>() ? (V)((U)~(U)0 >> 1) : (V)~(U)0;
+}
+
+template <class V>
+constexpr V minValue() {
+  return isSigned<V>() ? (V)(-maxValue<V>() - 1) : (V)0;
+}
+
+/*
+ * Byte order
+ *
+ * The wire format is little endian. On big endian hosts values are
+ * swapped as they are written and read, on little endian hosts the
+ * conversions compile away.
+ */
+
+inline uint8_t swapBytes(uint8_t val) {
+  return val;
+}
+
+inline uint16_t swapBytes(uint16_t val) {
+#ifdef __GNUC__
+  return __builtin_bswap16(val);
+#else
+  return (uint16_t)((val << 8) | (val >> 8));
+#endif
+}
+
+inline uint32_t swapBytes(uint32_t val) {
+#ifdef __GNUC__
+  return __builtin_bswap32(val);
+#else
+  return ((val & 0x000000fful) << 24) | ((val & 0x0000ff00ul) << 8) |
+         ((val & 0x00ff0000ul) >> 8) | ((val & 0xff000000ul) >> 24);
+#endif
+}
+
+inline uint64_t swapBytes(uint64_t val) {
+#ifdef __GNUC__
+  return __builtin_bswap64(val);
+#else
+  return ((uint64_t)swapBytes((uint32_t)val) << 32) | swapBytes((uint32_t)(val >> 32));
+#endif
+}
+
+// Swaps any value by swapping the unsigned integer of the same size
+template <class V>
+V byteSwap(V val) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  U bits;
+  memcpy(&bits, &val, sizeof(val));
+  bits = swapBytes(bits);
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+
+// Swapping is its own inverse, so this converts in both directions
+template <class V>
+V toLittleEndian(V val) {
+#if BAKELITE_BIG_ENDIAN
+  return byteSwap(val);
+#else
+  return val;
+#endif
+}
+
+// In-place conversion of an array. The loop body is a single swap,
+// which compilers turn into vector permutes (vperm, xxbrw, etc.).
+template <class V>
+void toLittleEndian(V *data, int size) {
+#if BAKELITE_BIG_ENDIAN
+  for(int i = 0; i < size; i++) {
+    data[i] = byteSwap(data[i]);
+  }
+#else
+  (void)data;
+  (void)size;
+#endif
+}
+
 class BufferStream {
 public:
   BufferStream(char *buff, uint32_t size,
@@ -21,8 +141,7 @@ public:
   {}
 
   int write(const char *data, uint32_t length) {
-    uint32_t endPos = m_pos + length;
-    if(endPos > m_size) {
+    if(length > m_size - m_pos) {
       return -1;
     }
 
@@ -33,8 +152,7 @@ public:
   }
 
   int read(char *data, uint32_t length) {
-    uint32_t endPos = m_pos + length;
-    if(endPos > m_size) {
+    if(length > m_size - m_pos) {
       return -2;
     }
 
@@ -62,16 +180,48 @@ public:
     return m_pos;
   }
 
+  // Bytes of the heap handed out by alloc() so far
+  size_t heapUsed() const {
+    return m_heapPos;
+  }
+
+  // Reads up to and including the terminator into memory from alloc(),
+  // with a single search and copy.
+  int readUntil(char terminator, char* &val) {
+    const char *start = m_buff + m_pos;
+    const char *end = (const char *)memchr(start, terminator, m_size - m_pos);
+    if(end == nullptr) {
+      return -2;
+    }
+
+    size_t length = (size_t)(end - start) + 1;
+    val = alloc(length);
+    if(val == nullptr) {
+      return -6;
+    }
+
+    memcpy(val, start, length);
+    m_pos += length;
+    return 0;
+  }
+
   char *alloc(size_t bytes) {
-    size_t newPos = m_heapPos + bytes;
-    if(newPos >= m_heapSize)
+    if(bytes > m_heapSize - m_heapPos)
       return nullptr;
 
     char *data = &m_heap[m_heapPos];
-    m_heapPos = newPos;
+    m_heapPos += bytes;
     return data;
   }
 
+  // Allocates count elements of size bytes, checking count before
+  // multiplying so a large count can't wrap a small size_t.
+  char *allocArray(size_t count, size_t size) {
+    if(count > (m_heapSize - m_heapPos) / size)
+      return nullptr;
+    return alloc(count * size);
+  }
+
 private:
   char *m_buff;
   size_t m_size;
@@ -84,6 +234,7 @@ private:
 
 template <class T, class V>
 int write(T& stream, V val) {
+  val = toLittleEndian(val);
   return stream.write((const char *)&val, sizeof(val));
 }
 
@@ -97,9 +248,11 @@ int writeArray(T& stream, const V *val, int size, F writeCb) {
   return 0;
 }
 
-template <class T, class V, class F>
-int writeArray(T& stream, const SizedArray<V> &val, F writeCb) {
-  write(stream, val.size);
+template <class T, class V, class F, class S>
+int writeArray(T& stream, const SizedArray<V, S> &val, F writeCb) {
+  int rcode = write(stream, val.size);
+  if(rcode != 0)
+    return rcode;
   for(int i = 0; i < val.size; i++) {
     int rcode = writeCb(stream, val.at(i));
     if(rcode != 0)
@@ -108,14 +261,45 @@ int writeArray(T& stream, const SizedArray<V> &val, F writeCb) {
   return 0;
 }
 
+// Arrays of primitives are copied with a single stream call,
+// rather than one call per element.
+template <class T, class V>
+int writePrimitiveArray(T& stream, const V *val, int size) {
+#if BAKELITE_BIG_ENDIAN
+  // The source can't be swapped in place, so swap a block at a time
+  V block[16];
+  for(int i = 0; i < size; i += 16) {
+    int count = size - i < 16 ? size - i : 16;
+    memcpy(block, val + i, sizeof(V) * count);
+    toLittleEndian(block, count);
+    int rcode = stream.write((const char *)block, sizeof(V) * count);
+    if(rcode != 0)
+      return rcode;
+  }
+  return 0;
+#else
+  return stream.write((const char *)val, sizeof(V) * size);
+#endif
+}
+
+template <class T, class V, class S>
+int writePrimitiveArray(T& stream, const SizedArray<V, S> &val) {
+  int rcode = write(stream, val.size);
+  if(rcode != 0)
+    return rcode;
+  return writePrimitiveArray(stream, val.data, val.size);
+}
+
 template <class T>
 int writeBytes(T& stream, const char *val, int size) {
   return stream.write((const char *)val, size);
 }
 
-template <class T>
-int writeBytes(T& stream, const SizedArray<char> &val) {
+template <class T, class S>
+int writeBytes(T& stream, const SizedArray<char, S> &val) {
   int rcode = write(stream, val.size);
+  if(rcode != 0)
+    return rcode;
   return stream.write((const char *)val.data, val.size);
 }
 
@@ -130,7 +314,7 @@ int writeString(T& stream, const char *val) {
     return write(stream, (uint8_t)0);
   }
 
-  uint8_t len = strlen(val);
+  size_t len = strlen(val);
   int rcode = stream.write(val, len);
   if(rcode != 0)
     return rcode;
@@ -139,7 +323,9 @@ int writeString(T& stream, const char *val) {
 
 template <class T, class V>
 int read(T& stream, V &val) {
-  return stream.read((char *)&val, sizeof(val));
+  int rcode = stream.read((char *)&val, sizeof(val));
+  val = toLittleEndian(val);
+  return rcode;
 }
 
 template <class T, class V, class F>
@@ -159,7 +345,7 @@ int readArray(T& stream, SizedArray<V, S> &val, F readCb) {
   if(rcode != 0)
       return rcode;
 
-  val.data = (V*)stream.alloc(sizeof(V) * size);
+  val.data = (V*)stream.allocArray(size, sizeof(V));
   val.size = size;
 
   if(val.data == nullptr) {
@@ -174,6 +360,32 @@ int readArray(T& stream, SizedArray<V, S> &val, F readCb) {
   return 0;
 }
 
+template <class T, class V>
+int readPrimitiveArray(T& stream, V val[], int size) {
+  int rcode = stream.read((char *)val, sizeof(V) * size);
+  if(rcode != 0)
+    return rcode;
+  toLittleEndian(val, size);
+  return 0;
+}
+
+template <class T, class V, class S>
+int readPrimitiveArray(T& stream, SizedArray<V, S> &val) {
+  S size = 0;
+  int rcode = read(stream, size);
+  if(rcode != 0)
+      return rcode;
+
+  val.data = (V*)stream.allocArray(size, sizeof(V));
+  val.size = size;
+
+  if(val.data == nullptr) {
+    return -4;
+  }
+
+  return readPrimitiveArray(stream, val.data, size);
+}
+
 template <class T>
 int readBytes(T& stream, char *val, int size) {
   return stream.read(val, size);
@@ -201,8 +413,18 @@ int readString(T& stream, char *val, int size) {
   return stream.read(val, size);
 }
 
+// Streams that provide readUntil() find the end of the string in one pass,
+// others are read a byte at a time.
+struct ByteByByte {};
+struct UntilTerminator: ByteByByte {};
+
 template <class T>
-int readString(T& stream, char* &val) {
+auto readStringImpl(T& stream, char* &val, UntilTerminator) -> decltype(stream.readUntil('\0', val)) {
+  return stream.readUntil('\0', val);
+}
+
+template <class T>
+int readStringImpl(T& stream, char* &val, ByteByByte) {
   char *newByte = stream.alloc(1);
   val = newByte;
 
@@ -217,4 +439,732 @@ int readString(T& stream, char* &val) {
   } while((newByte = stream.alloc(1)) != nullptr);
 
   return -6;
-}
\ No newline at end of file
+}
+
+template <class T>
+int readString(T& stream, char* &val) {
+  return readStringImpl(stream, val, UntilTerminator());
+}
+
+// Strings with a length prefix, and no terminator on the wire.
+// S is the type of the length prefix.
+template <class S = uint8_t, class T>
+int writePrefixedString(T& stream, const char *val) {
+  size_t len = val == nullptr ? 0 : strlen(val);
+  S size = (S)len;
+  if((size_t)size != len) {
+    return -1;
+  }
+
+  int rcode = write(stream, size);
+  if(rcode != 0 || len == 0)
+    return rcode;
+  return stream.write(val, len);
+}
+
+template <class S = uint8_t, class T>
+int readPrefixedString(T& stream, char* &val) {
+  S len = 0;
+  int rcode = read(stream, len);
+  if(rcode != 0)
+    return rcode;
+
+  // A prefix longer than the rest of the stream can't be valid, and
+  // len + 1 could wrap
+  if((size_t)len > (size_t)(stream.size() - stream.pos()))
+    return -2;
+
+  val = stream.alloc((size_t)len + 1);
+  if(val == nullptr) {
+    return -6;
+  }
+
+  val[len] = 0;
+  return stream.read(val, len);
+}
+
+/*
+ * Half precision floats
+ *
+ * float16 members are stored as float in memory, and as IEEE-754
+ * binary16 on the wire. Conversion rounds to nearest even, values too
+ * large for a half become infinity, and NaN stays NaN.
+ */
+
+inline uint16_t floatToHalf(float val) {
+  uint32_t x;
+  memcpy(&x, &val, sizeof(x));
+
+  uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+  uint32_t exp = (x >> 23) & 0xff;
+  uint32_t mant = x & 0x7fffff;
+
+  if(exp == 0xff) {
+    return sign | 0x7c00 | (mant ? 0x200 | (mant >> 13) : 0);
+  }
+
+  int32_t halfExp = (int32_t)exp - 127 + 15;
+  if(halfExp >= 0x1f) {
+    return sign | 0x7c00;
+  }
+
+  uint32_t half;
+  uint32_t rem;
+  uint32_t mid;
+  if(halfExp <= 0) {
+    // Subnormal, or too small and rounds to zero
+    if(halfExp < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    uint32_t shift = (uint32_t)(14 - halfExp);
+    half = mant >> shift;
+    rem = mant & ((1ul << shift) - 1);
+    mid = 1ul << (shift - 1);
+  }
+  else {
+    half = ((uint32_t)halfExp << 10) | (mant >> 13);
+    rem = mant & 0x1fff;
+    mid = 0x1000;
+  }
+
+  // A carry out of the mantissa correctly bumps the exponent
+  if(rem > mid || (rem == mid && (half & 1))) {
+    half++;
+  }
+  return sign | (uint16_t)half;
+}
+
+inline float halfToFloat(uint16_t half) {
+  uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+  uint32_t exp = (half >> 10) & 0x1f;
+  uint32_t mant = half & 0x3ff;
+  uint32_t x;
+
+  if(exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  }
+  else if(exp != 0) {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  }
+  else if(mant == 0) {
+    x = sign;
+  }
+  else {
+    // Subnormal halfs are normal floats
+    exp = 127 - 14;
+    while(!(mant & 0x400)) {
+      mant <<= 1;
+      exp--;
+    }
+    x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+  }
+
+  float val;
+  memcpy(&val, &x, sizeof(val));
+  return val;
+}
+
+template <class T>
+int writeHalf(T& stream, float val) {
+  return write(stream, floatToHalf(val));
+}
+
+template <class T>
+int readHalf(T& stream, float &val) {
+  uint16_t half = 0;
+  int rcode = read(stream, half);
+  val = halfToFloat(half);
+  return rcode;
+}
+
+// Arrays are converted in blocks, using F16C or NEON when available,
+// and written with one call per block.
+template <class T>
+int writeHalfArray(T& stream, const float *val, int size) {
+  uint16_t block[8];
+  int i = 0;
+
+#if defined(__F16C__)
+  for(; i + 8 <= size; i += 8) {
+    __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(val + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i *)block, half);
+    int rcode = stream.write((const char *)block, sizeof(block));
+    if(rcode != 0)
+      return rcode;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !BAKELITE_BIG_ENDIAN
+  for(; i + 4 <= size; i += 4) {
+    float16x4_t half = vcvt_f16_f32(vld1q_f32(val + i));
+    vst1_u16(block, vreinterpret_u16_f16(half));
+    int rcode = stream.write((const char *)block, sizeof(uint16_t) * 4);
+    if(rcode != 0)
+      return rcode;
+  }
+#endif
+
+  while(i < size) {
+    int count = size - i < 8 ? size - i : 8;
+    for(int j = 0; j < count; j++) {
+      block[j] = floatToHalf(val[i + j]);
+    }
+    toLittleEndian(block, count);
+    int rcode = stream.write((const char *)block, sizeof(uint16_t) * count);
+    if(rcode != 0)
+      return rcode;
+    i += count;
+  }
+  return 0;
+}
+
+template <class T, class S>
+int writeHalfArray(T& stream, const SizedArray<float, S> &val) {
+  int rcode = write(stream, val.size);
+  if(rcode != 0)
+    return rcode;
+  return writeHalfArray(stream, val.data, val.size);
+}
+
+template <class T>
+int readHalfArray(T& stream, float val[], int size) {
+  uint16_t block[8];
+  int i = 0;
+
+#if defined(__F16C__)
+  for(; i + 8 <= size; i += 8) {
+    int rcode = stream.read((char *)block, sizeof(block));
+    if(rcode != 0)
+      return rcode;
+    _mm256_storeu_ps(val + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)block)));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !BAKELITE_BIG_ENDIAN
+  for(; i + 4 <= size; i += 4) {
+    int rcode = stream.read((char *)block, sizeof(uint16_t) * 4);
+    if(rcode != 0)
+      return rcode;
+    vst1q_f32(val + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(block))));
+  }
+#endif
+
+  while(i < size) {
+    int count = size - i < 8 ? size - i : 8;
+    int rcode = stream.read((char *)block, sizeof(uint16_t) * count);
+    if(rcode != 0)
+      return rcode;
+    toLittleEndian(block, count);
+    for(int j = 0; j < count; j++) {
+      val[i + j] = halfToFloat(block[j]);
+    }
+    i += count;
+  }
+  return 0;
+}
+
+template <class T, class S>
+int readHalfArray(T& stream, SizedArray<float, S> &val) {
+  S size = 0;
+  int rcode = read(stream, size);
+  if(rcode != 0)
+      return rcode;
+
+  val.data = (float*)stream.allocArray(size, sizeof(float));
+  val.size = size;
+
+  if(val.data == nullptr) {
+    return -4;
+  }
+
+  return readHalfArray(stream, val.data, size);
+}
+
+/*
+ * Scaled floats
+ *
+ * A float is stored on the wire as the integer W,
+ * round((val - offset) / scale), rounding half away from zero.
+ * Values outside the range of W are clamped, and NaN is stored as 0.
+ * The generator passes 1 / scale, so encoding is a multiply.
+ */
+
+template <class W, class F>
+W quantize(F val, F invScale, F offset) {
+  const F lo = (F)minValue<W>();
+  const F hi = (F)maxValue<W>();
+  F x = (val - offset) * invScale;
+
+  // Selects rather than branches, so loops over quantize vectorize. Each
+  // select picks between values that are already computed.
+  x += x < 0 ? (F)-0.5 : (F)0.5;
+  x = x == x ? x : (F)0;
+  x = x > lo ? x : lo;
+  // hi may have rounded up past the range of W, so it is exclusive, and
+  // x is only converted once it's in range
+  bool over = x >= hi;
+  W result = (W)(over ? (F)0 : x);
+  return over ? maxValue<W>() : result;
+}
+
+template <class W, class F>
+F dequantize(W val, F scale, F offset) {
+  return (F)val * scale + offset;
+}
+
+template <class W, class T, class F>
+int writeScaled(T& stream, F val, F invScale, F offset) {
+  return write(stream, quantize<W>(val, invScale, offset));
+}
+
+template <class W, class T, class F>
+int readScaled(T& stream, F &val, F scale, F offset) {
+  W raw = 0;
+  int rcode = read(stream, raw);
+  val = dequantize(raw, scale, offset);
+  return rcode;
+}
+
+// Arrays are converted a block at a time. Full blocks are converted by
+// loops with a constant trip count and no branches, which the compiler
+// vectorizes at -O2.
+constexpr int scaledBlockSize = 16;
+
+template <class W, class F>
+void quantizeBlock(W *block, const F *val, int count, F invScale, F offset) {
+  if(count == scaledBlockSize) {
+    for(int j = 0; j < scaledBlockSize; j++) {
+      block[j] = quantize<W>(val[j], invScale, offset);
+    }
+    return;
+  }
+  for(int j = 0; j < count; j++) {
+    block[j] = quantize<W>(val[j], invScale, offset);
+  }
+}
+
+template <class W, class F>
+void dequantizeBlock(F *val, const W *block, int count, F scale, F offset) {
+  if(count == scaledBlockSize) {
+    for(int j = 0; j < scaledBlockSize; j++) {
+      val[j] = dequantize(block[j], scale, offset);
+    }
+    return;
+  }
+  for(int j = 0; j < count; j++) {
+    val[j] = dequantize(block[j], scale, offset);
+  }
+}
+
+template <class W, class T, class F>
+int writeScaledArray(T& stream, const F *val, int size, F invScale, F offset) {
+  W block[scaledBlockSize];
+
+  for(int i = 0; i < size; i += scaledBlockSize) {
+    int count = size - i < scaledBlockSize ? size - i : scaledBlockSize;
+    quantizeBlock(block, val + i, count, invScale, offset);
+    toLittleEndian(block, count);
+    int rcode = stream.write((const char *)block, sizeof(W) * count);
+    if(rcode != 0)
+      return rcode;
+  }
+  return 0;
+}
+
+template <class W, class T, class F, class S>
+int writeScaledArray(T& stream, const SizedArray<F, S> &val, F invScale, F offset) {
+  int rcode = write(stream, val.size);
+  if(rcode != 0)
+    return rcode;
+  return writeScaledArray<W>(stream, val.data, val.size, invScale, offset);
+}
+
+template <class W, class T, class F>
+int readScaledArray(T& stream, F val[], int size, F scale, F offset) {
+  W block[scaledBlockSize];
+
+  for(int i = 0; i < size; i += scaledBlockSize) {
+    int count = size - i < scaledBlockSize ? size - i : scaledBlockSize;
+    int rcode = stream.read((char *)block, sizeof(W) * count);
+    if(rcode != 0)
+      return rcode;
+    toLittleEndian(block, count);
+    dequantizeBlock(val + i, block, count, scale, offset);
+  }
+  return 0;
+}
+
+template <class W, class T, class F, class S>
+int readScaledArray(T& stream, SizedArray<F, S> &val, F scale, F offset) {
+  S size = 0;
+  int rcode = read(stream, size);
+  if(rcode != 0)
+      return rcode;
+
+  val.data = (F*)stream.allocArray(size, sizeof(F));
+  val.size = size;
+
+  if(val.data == nullptr) {
+    return -4;
+  }
+
+  return readScaledArray<W>(stream, val.data, size, scale, offset);
+}
+
+/*
+ * Bitfields
+ *
+ * All members of a bitfield are packed into one word, first member in
+ * the least significant bits, and stored using the smallest number of
+ * bytes that fit.
+ */
+
+template <class T, class W>
+int writeBits(T& stream, W bits, size_t length) {
+  // The low bytes come first once the word is little endian
+  bits = toLittleEndian(bits);
+  return stream.write((const char *)&bits, length);
+}
+
+template <class W, class T, class F>
+int readBits(T& stream, size_t length, F readCb) {
+  W bits = 0;
+  int rcode = stream.read((char *)&bits, length);
+  if(rcode != 0)
+    return rcode;
+
+  readCb(toLittleEndian(bits));
+  return 0;
+}
+
+// Sign extend the low Bits bits of raw into a signed type
+template <class V, unsigned Bits, class W>
+V signExtend(W raw) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  const U ones = (U)~(U)0;
+  const U mask = (U)(ones >> (sizeof(U) * 8 - Bits));
+  U value = (U)raw & mask;
+
+  if(value & ((U)1 << (Bits - 1))) {
+    value |= (U)~mask;
+  }
+  return (V)value;
+}
+
+/*
+ * Variable length integers
+ *
+ * Unsigned values are encoded as LEB128, 7 bits per byte, least
+ * significant group first. Signed values are zigzag encoded first, so
+ * small negative numbers stay small on the wire.
+ */
+
+template <class V>
+typename UIntOfSize<sizeof(V)>::type zigzagEncode(V val) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  U u = (U)val;
+  return (U)((U)(u << 1) ^ (U)(0 - (U)(u >> (sizeof(V) * 8 - 1))));
+}
+
+template <class V>
+V zigzagDecode(typename UIntOfSize<sizeof(V)>::type u) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  return (V)(U)((U)(u >> 1) ^ (U)(0 - (U)(u & 1)));
+}
+
+template <class T, class U>
+int writeLeb128(T& stream, U val) {
+  char buff[(sizeof(U) * 8 + 6) / 7];
+  int length = 0;
+
+  do {
+    uint8_t byte = val & 0x7F;
+    val = (U)(val >> 7);
+    if(val != 0) {
+      byte |= 0x80;
+    }
+    buff[length++] = (char)byte;
+  } while(val != 0);
+
+  return stream.write(buff, length);
+}
+
+template <class T, class U>
+int readLeb128(T& stream, U &val) {
+  val = 0;
+
+  for(unsigned shift = 0; shift < sizeof(U) * 8; shift += 7) {
+    uint8_t byte = 0;
+    int rcode = read(stream, byte);
+    if(rcode != 0)
+      return rcode;
+
+    val |= (U)((U)(byte & 0x7F) << shift);
+    if((byte & 0x80) == 0) {
+      return 0;
+    }
+  }
+
+  // Too many continuation bytes for the destination type
+  return -7;
+}
+
+// Size type for arrays, bytes and strings with a varint length prefix
+struct VarintSize {
+  uint32_t value;
+
+  VarintSize(uint32_t val = 0): value(val) {}
+
+  operator uint32_t() const {
+    return value;
+  }
+};
+
+template <class T>
+int write(T& stream, VarintSize val) {
+  return writeLeb128(stream, val.value);
+}
+
+template <class T>
+int read(T& stream, VarintSize &val) {
+  return readLeb128(stream, val.value);
+}
+
+template <class T, class V>
+int writeVarint(T& stream, V val) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  if(isSigned<V>()) {
+    return writeLeb128(stream, zigzagEncode(val));
+  }
+  return writeLeb128(stream, (U)val);
+}
+
+template <class T, class V>
+int readVarint(T& stream, V &val) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  U u = 0;
+  int rcode = readLeb128(stream, u);
+  if(rcode != 0)
+    return rcode;
+
+  val = isSigned<V>() ? zigzagDecode<V>(u) : (V)u;
+  return 0;
+}
+
+/*
+ * Element codecs, used to select the on-wire representation of
+ * array elements and size prefixes.
+ */
+
+// Fixed width, the same size as the in-memory type
+struct RawCodec {
+  template <class T, class V>
+  static int write(T& stream, V val) {
+    return Bakelite::write(stream, val);
+  }
+
+  template <class T, class V>
+  static int read(T& stream, V &val) {
+    return Bakelite::read(stream, val);
+  }
+};
+
+// LEB128, zigzag encoded if the value is signed
+struct VarintCodec {
+  template <class T, class V>
+  static int write(T& stream, V val) {
+    return writeVarint(stream, val);
+  }
+
+  template <class T, class V>
+  static int read(T& stream, V &val) {
+    return readVarint(stream, val);
+  }
+};
+
+/*
+ * Delta encoded arrays
+ *
+ * Each element is stored as the difference from the previous element,
+ * with the first element stored as the difference from zero.
+ * Differences use wrapping arithmetic, so every value round trips.
+ * When combined with VarintCodec, differences are treated as signed,
+ * so a slowly falling signal is as cheap as a slowly rising one.
+ */
+
+// In-place inclusive prefix sum, used to rebuild delta encoded arrays.
+// Decoding the differences and summing them are kept as separate passes,
+// so the decode loop carries no dependency between elements.
+template <class U>
+void prefixSum(U *data, int size) {
+  for(int i = 1; i < size; i++) {
+    data[i] = (U)(data[i] + data[i - 1]);
+  }
+}
+
+#ifdef __SSE2__
+// Log-step scan within a 128 bit register, carrying the last lane forward.
+template <>
+inline void prefixSum<uint32_t>(uint32_t *data, int size) {
+  int i = 0;
+  __m128i carry = _mm_setzero_si128();
+  for(; i + 4 <= size; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, carry);
+    _mm_storeu_si128((__m128i *)(data + i), x);
+    carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if(i == 0) {
+    i = 1;
+  }
+  for(; i < size; i++) {
+    data[i] += data[i - 1];
+  }
+}
+
+template <>
+inline void prefixSum<uint16_t>(uint16_t *data, int size) {
+  int i = 0;
+  __m128i carry = _mm_setzero_si128();
+  for(; i + 8 <= size; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+    x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi16(x, carry);
+    _mm_storeu_si128((__m128i *)(data + i), x);
+    carry = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+    carry = _mm_unpackhi_epi64(carry, carry);
+  }
+  if(i == 0) {
+    i = 1;
+  }
+  for(; i < size; i++) {
+    data[i] = (uint16_t)(data[i] + data[i - 1]);
+  }
+}
+#endif
+
+template <class E, class T, class V>
+int writeDeltaArray(T& stream, const V *val, int size) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  using D = typename IntOfSize<sizeof(V)>::type;
+  U prev = 0;
+
+  for(int i = 0; i < size; i++) {
+    U diff = (U)((U)val[i] - prev);
+    prev = (U)val[i];
+
+    // Differences are signed, even for unsigned types
+    int rcode = E::write(stream, (D)diff);
+    if(rcode != 0)
+      return rcode;
+  }
+  return 0;
+}
+
+template <class E, class T, class V, class S>
+int writeDeltaArray(T& stream, const SizedArray<V, S> &val) {
+  int rcode = write(stream, val.size);
+  if(rcode != 0)
+    return rcode;
+  return writeDeltaArray<E>(stream, val.data, val.size);
+}
+
+template <class E, class T, class V>
+int readDeltaArray(T& stream, V val[], int size) {
+  using U = typename UIntOfSize<sizeof(V)>::type;
+  using D = typename IntOfSize<sizeof(V)>::type;
+  U *out = (U *)val;
+
+  for(int i = 0; i < size; i++) {
+    D diff = 0;
+    int rcode = E::read(stream, diff);
+    if(rcode != 0)
+      return rcode;
+    out[i] = (U)diff;
+  }
+
+  prefixSum(out, size);
+  return 0;
+}
+
+template <class E, class T, class V, class S>
+int readDeltaArray(T& stream, SizedArray<V, S> &val) {
+  S size = 0;
+  int rcode = read(stream, size);
+  if(rcode != 0)
+      return rcode;
+
+  val.data = (V*)stream.allocArray(size, sizeof(V));
+  val.size = size;
+
+  if(val.data == nullptr) {
+    return -4;
+  }
+
+  return readDeltaArray<E>(stream, val.data, size);
+}
+
+// Columnar unpacking, used by the generated unpackColumns(). A null
+// column is skipped.
+
+#ifdef __AVX2__
+// Gathers 4 byte or 8 byte values from 4 messages at a time. The message
+// pointers are loaded as 64 bit indices, relative to the first message.
+// Returns how many rows were copied.
+template <size_t Size>
+size_t gatherColumn(char *column, const char *const *messages, size_t count, size_t offset) {
+  return 0;
+}
+
+template <>
+inline size_t gatherColumn<4>(char *column, const char *const *messages, size_t count, size_t offset) {
+  const char *base = messages[0] + offset;
+  const __m256i first = _mm256_set1_epi64x((long long)(intptr_t)messages[0]);
+  size_t rows = count & ~(size_t)3;
+  for(size_t i = 0; i < rows; i += 4) {
+    __m256i index = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(messages + i)), first);
+    __m128i values = _mm256_i64gather_epi32((const int *)base, index, 1);
+    _mm_storeu_si128((__m128i *)(column + i * 4), values);
+  }
+  return rows;
+}
+
+template <>
+inline size_t gatherColumn<8>(char *column, const char *const *messages, size_t count, size_t offset) {
+  const char *base = messages[0] + offset;
+  const __m256i first = _mm256_set1_epi64x((long long)(intptr_t)messages[0]);
+  size_t rows = count & ~(size_t)3;
+  for(size_t i = 0; i < rows; i += 4) {
+    __m256i index = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(messages + i)), first);
+    __m256i values = _mm256_i64gather_epi64((const long long *)base, index, 1);
+    _mm256_storeu_si256((__m256i *)(column + i * 8), values);
+  }
+  return rows;
+}
+#endif
+
+// Copies the value at offset in each packed message into column. Only
+// valid for values stored as they are in memory, on little endian hosts.
+// With AVX2, 4 and 8 byte values are gathered 4 rows at a time.
+template <class V>
+void copyColumn(V *column, const char *const *messages, size_t count, size_t offset) {
+  if(column == nullptr || count == 0) {
+    return;
+  }
+
+  size_t i = 0;
+#ifdef __AVX2__
+  i = gatherColumn<sizeof(V)>((char *)column, messages, count, offset);
+#endif
+  for(; i < count; i++) {
+    memcpy((void *)&column[i], messages[i] + offset, sizeof(V));
+  }
+}
+
+template <class V>
+void setColumn(V *column, size_t row, const V &val) {
+  if(column != nullptr) {
+    memcpy((void *)&column[row], (const void *)&val, sizeof(V));
+  }
+}
@@ -0,0 +1,277 @@
+/*
+ * Link statistics
+ *
+ * The framer and protocol report what they see to a statistics policy,
+ * given as a framer template parameter. NoStats compiles to nothing,
+ * LinkStats counts everything, and LatencyStats times each stage of the
+ * pipeline. StatsPair combines two policies. A custom policy can derive
+ * from NoStats and replace the hooks it needs.
+ *
+ * Frame lengths are as seen on the wire, including the delimiter.
+ */
+
+// Points in the receive and send pipelines, passed to trace()
+enum class TraceEvent {
+  FrameStart,   // First byte of a frame
+  Delimiter,    // End of frame delimiter
+  Decoded,      // COBS decoding done
+  CrcChecked,   // CRC matched
+  Dispatched,   // poll() returned the message
+  PackStart,    // send() called
+  Encoded,      // Frame packed, CRC added and COBS encoded
+  Written,      // Frame written to the transport
+};
+
+class NoStats {
+public:
+  void byteReceived() {}
+  void frameReceived(CobsDecodeState, size_t) {}
+  void frameSent(size_t) {}
+  void messageReceived(uint8_t, size_t) {}
+  void messageSent(uint8_t, size_t) {}
+  // id is only set for Dispatched, PackStart and Written
+  void trace(TraceEvent, uint8_t) {}
+};
+
+// Counts are kept for message IDs below MessageIds, higher IDs are only
+// included in the totals.
+template <size_t MessageIds = 16>
+class LinkStats : public NoStats {
+public:
+  struct Snapshot {
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+
+    uint32_t framesDecoded;
+    uint32_t decodeFailures;
+    uint32_t crcFailures;
+    uint32_t overruns;
+    // Dropped by the frame filter, without being decoded
+    uint32_t rejected;
+    uint32_t framesSent;
+
+    // Good frames received after one or more bad ones
+    uint32_t resyncs;
+
+    uint32_t maxFrameIn;
+    uint32_t maxFrameOut;
+
+    uint32_t messagesIn[MessageIds];
+    uint32_t messageBytesIn[MessageIds];
+    uint32_t messagesOut[MessageIds];
+    uint32_t messageBytesOut[MessageIds];
+  };
+
+  Snapshot snapshot() const {
+    return m_counters;
+  }
+
+  void reset() {
+    m_counters = Snapshot();
+    m_inError = false;
+  }
+
+  void byteReceived() {
+    m_counters.bytesIn++;
+  }
+
+  void frameReceived(CobsDecodeState status, size_t length) {
+    // A lone delimiter is idle line, not a frame
+    if(length <= 1) {
+      return;
+    }
+
+    if(length > m_counters.maxFrameIn) {
+      m_counters.maxFrameIn = length;
+    }
+
+    switch(status) {
+    case CobsDecodeState::Decoded:
+      m_counters.framesDecoded++;
+      if(m_inError) {
+        m_counters.resyncs++;
+        m_inError = false;
+      }
+      return;
+    case CobsDecodeState::DecodeFailure:
+      m_counters.decodeFailures++;
+      break;
+    case CobsDecodeState::CrcFailure:
+      m_counters.crcFailures++;
+      break;
+    case CobsDecodeState::BufferOverrun:
+      m_counters.overruns++;
+      break;
+    case CobsDecodeState::Rejected:
+      m_counters.rejected++;
+      break;
+    default:
+      return;
+    }
+    m_inError = true;
+  }
+
+  void frameSent(size_t length) {
+    m_counters.framesSent++;
+    m_counters.bytesOut += length;
+    if(length > m_counters.maxFrameOut) {
+      m_counters.maxFrameOut = length;
+    }
+  }
+
+  void messageReceived(uint8_t id, size_t length) {
+    if(id < MessageIds) {
+      m_counters.messagesIn[id]++;
+      m_counters.messageBytesIn[id] += length;
+    }
+  }
+
+  void messageSent(uint8_t id, size_t length) {
+    if(id < MessageIds) {
+      m_counters.messagesOut[id]++;
+      m_counters.messageBytesOut[id] += length;
+    }
+  }
+
+private:
+  Snapshot m_counters = Snapshot();
+  bool m_inError = false;
+};
+
+// Stages timed by LatencyStats, between two trace events
+enum class LatencyStage {
+  Receive,    // FrameStart to Delimiter, the transport and framer
+  Decode,     // Delimiter to Decoded
+  Crc,        // Decoded to CrcChecked
+  Dispatch,   // CrcChecked to Dispatched, including fragment reassembly
+  Pack,       // PackStart to Encoded
+  Write,      // Encoded to Written
+};
+
+constexpr size_t latencyStages = 6;
+
+// Per message ID histograms of how long each stage takes, in ticks of
+// the clock set by setClock. Bucket 0 counts 0 ticks, bucket n counts
+// [2^(n-1), 2^n) ticks, and the last bucket counts everything longer.
+// Nothing is timed until a clock is set.
+template <size_t MessageIds = 8, size_t Buckets = 16>
+class LatencyStats : public NoStats {
+public:
+  struct Histogram {
+    uint32_t counts[Buckets];
+    unsigned long max;
+  };
+
+  void setClock(ClockFn clock) {
+    m_clock = clock;
+  }
+
+  const Histogram &histogram(uint8_t id, LatencyStage stage) const {
+    assert(id < MessageIds);
+    return m_histograms[id][(size_t)stage];
+  }
+
+  void reset() {
+    for(size_t i = 0; i < MessageIds; i++) {
+      for(size_t j = 0; j < latencyStages; j++) {
+        m_histograms[i][j] = Histogram();
+      }
+    }
+  }
+
+  void trace(TraceEvent event, uint8_t id) {
+    if(m_clock == nullptr) {
+      return;
+    }
+    unsigned long now = (*m_clock)();
+    m_times[(size_t)event] = now;
+
+    if(id >= MessageIds) {
+      return;
+    }
+    if(event == TraceEvent::Dispatched) {
+      record(id, LatencyStage::Receive, TraceEvent::FrameStart, TraceEvent::Delimiter);
+      record(id, LatencyStage::Decode, TraceEvent::Delimiter, TraceEvent::Decoded);
+      record(id, LatencyStage::Crc, TraceEvent::Decoded, TraceEvent::CrcChecked);
+      record(id, LatencyStage::Dispatch, TraceEvent::CrcChecked, TraceEvent::Dispatched);
+    }
+    else if(event == TraceEvent::Written) {
+      record(id, LatencyStage::Pack, TraceEvent::PackStart, TraceEvent::Encoded);
+      record(id, LatencyStage::Write, TraceEvent::Encoded, TraceEvent::Written);
+    }
+  }
+
+private:
+  void record(uint8_t id, LatencyStage stage, TraceEvent start, TraceEvent end) {
+    unsigned long ticks = m_times[(size_t)end] - m_times[(size_t)start];
+    Histogram &histogram = m_histograms[id][(size_t)stage];
+
+    size_t bucket = 0;
+    for(unsigned long t = ticks; t > 0 && bucket < Buckets - 1; t >>= 1) {
+      bucket++;
+    }
+    histogram.counts[bucket]++;
+    if(ticks > histogram.max) {
+      histogram.max = ticks;
+    }
+  }
+
+  ClockFn m_clock = nullptr;
+  unsigned long m_times[(size_t)TraceEvent::Written + 1] = {};
+  Histogram m_histograms[MessageIds][latencyStages] = {};
+};
+
+// Reports to two policies, for example LinkStats and LatencyStats
+template <class A, class B>
+class StatsPair {
+public:
+  A &first() {
+    return m_first;
+  }
+
+  const A &first() const {
+    return m_first;
+  }
+
+  B &second() {
+    return m_second;
+  }
+
+  const B &second() const {
+    return m_second;
+  }
+
+  void byteReceived() {
+    m_first.byteReceived();
+    m_second.byteReceived();
+  }
+
+  void frameReceived(CobsDecodeState status, size_t length) {
+    m_first.frameReceived(status, length);
+    m_second.frameReceived(status, length);
+  }
+
+  void frameSent(size_t length) {
+    m_first.frameSent(length);
+    m_second.frameSent(length);
+  }
+
+  void messageReceived(uint8_t id, size_t length) {
+    m_first.messageReceived(id, length);
+    m_second.messageReceived(id, length);
+  }
+
+  void messageSent(uint8_t id, size_t length) {
+    m_first.messageSent(id, length);
+    m_second.messageSent(id, length);
+  }
+
+  void trace(TraceEvent event, uint8_t id) {
+    m_first.trace(event, id);
+    m_second.trace(event, id);
+  }
+
+private:
+  A m_first;
+  B m_second;
+};
@@ -1,5 +1,5 @@
 from dataclasses import dataclass
-from typing import Any, List, Optional
+from typing import Any, Dict, List, Optional, Union
 
 from dataclasses_json import DataClassJsonMixin
 
@@ -47,6 +47,9 @@ class ProtoStructMember(DataClassJsonMixin):
   comment: Optional[str]
   annotations: List[ProtoAnnotation]
   arraySize: Optional[int]
+  # Members of the same bitfield are packed together.
+  # None if the member is not part of a bitfield.
+  bitfieldGroup: Optional[int] = None
 
 
 @dataclass
@@ -55,6 +58,8 @@ class ProtoStruct(DataClassJsonMixin):
   name: str
   comment: Optional[str]
   annotations: List[ProtoAnnotation]
+  # "struct", "bitfield" or "union"
+  kind: str = "struct"
 
 
 @dataclass
@@ -92,6 +97,7 @@ def primitive_types() -> List[str]:
       "uint16",
       "uint32",
       "uint64",
+      "float16",
       "float32",
       "float64",
       "bytes",
@@ -101,3 +107,315 @@ def primitive_types() -> List[str]:
 
 def is_primitive(t: ProtoType) -> bool:
   return t.name in primitive_types()
+
+
+def integer_types() -> List[str]:
+  return [
+      "int8",
+      "int16",
+      "int32",
+      "int64",
+      "uint8",
+      "uint16",
+      "uint32",
+      "uint64",
+  ]
+
+
+def is_integer(t: ProtoType) -> bool:
+  return t.name in integer_types()
+
+
+def find_annotation(annotations: List[ProtoAnnotation], name: str) -> Optional[ProtoAnnotation]:
+  for annotation in annotations:
+    if annotation.name == name:
+      return annotation
+  return None
+
+
+def has_annotation(member: ProtoStructMember, name: str) -> bool:
+  return find_annotation(member.annotations, name) is not None
+
+
+def size_types() -> List[str]:
+  return [
+      "uint8",
+      "uint16",
+      "uint32",
+      "varint",
+  ]
+
+
+def size_type(member: ProtoStructMember) -> str:
+  """Type of the length prefixes of a member, set with @size.
+
+  Raises ValueError if the annotation is invalid.
+  """
+  annotation = find_annotation(member.annotations, "size")
+  if annotation is None:
+    return "uint8"
+
+  if len(annotation.arguments) != 1 or annotation.arguments[0].value not in size_types():
+    raise ValueError(f"@size must be one of {', '.join(size_types())}")
+  return annotation.arguments[0].value
+
+
+def has_size_prefix(member: ProtoStructMember) -> bool:
+  """True if the member is encoded with at least one length prefix."""
+  return (
+      member.arraySize == 0
+      or (member.type.name == "bytes" and member.type.size == 0)
+      or (member.type.name == "string" and member.type.size == 0
+          and has_annotation(member, "prefixed"))
+  )
+
+
+def bit_types() -> List[str]:
+  return [
+      "flag",
+      "uint",
+      "int",
+      "unused",
+  ]
+
+
+def is_bit_type(t: ProtoType) -> bool:
+  return t.name in bit_types()
+
+
+def bit_width(t: ProtoType) -> Optional[int]:
+  """Number of bits used by a type inside a bitfield, or None if it can't be used in one."""
+  if t.name in ("flag", "bool"):
+    return 1
+  elif t.name in ("uint", "int", "unused"):
+    return t.size
+  elif is_integer(t):
+    return int(t.name.lstrip('uint'))
+  return None
+
+
+def bitfield_groups(struct: ProtoStruct) -> List[Union[ProtoStructMember, List[ProtoStructMember]]]:
+  """Members of a struct, with the members of each bitfield collected into a list."""
+  items: List[Union[ProtoStructMember, List[ProtoStructMember]]] = []
+  group = None
+
+  for member in struct.members:
+    if member.bitfieldGroup is None:
+      items.append(member)
+    elif member.bitfieldGroup == group:
+      items[-1].append(member)  # type: ignore
+    else:
+      items.append([member])
+    group = member.bitfieldGroup
+
+  return items
+
+
+@dataclass
+class ScaledEncoding:
+  """A float stored on the wire as round((value - offset) / scale)."""
+  scale: float
+  offset: float
+  wireType: ProtoType
+
+
+def scaled_encoding(member: ProtoStructMember) -> Optional[ScaledEncoding]:
+  """The @scale/@offset encoding of a member, or None if it isn't scaled.
+
+  Raises ValueError if the annotation arguments are invalid.
+  """
+  scale = find_annotation(member.annotations, "scale")
+  if scale is None:
+    return None
+
+  positional = [arg.value for arg in scale.arguments if arg.name is None]
+  named = {arg.name: arg.value for arg in scale.arguments if arg.name is not None}
+  if not positional and "factor" in named:
+    positional.append(named["factor"])
+  if len(positional) > 1:
+    named.setdefault("type", positional[1])
+  if not positional:
+    raise ValueError("@scale requires a scale factor")
+
+  offset = find_annotation(member.annotations, "offset")
+  offset_value = 0.0
+  if offset is not None:
+    if len(offset.arguments) != 1:
+      raise ValueError("@offset requires exactly one value")
+    offset_value = float(offset.arguments[0].value)
+
+  return ScaledEncoding(
+      scale=float(positional[0]),
+      offset=offset_value,
+      wireType=ProtoType(name=named.get("type", "int16"), size=0),
+  )
+
+
+def max_count(member: ProtoStructMember) -> int:
+  """Largest number of elements a size prefix can describe."""
+  return {
+      "uint8": 0xFF,
+      "uint16": 0xFFFF,
+      "uint32": 0xFFFFFFFF,
+      "varint": 0xFFFFFFFF,
+  }[size_type(member)]
+
+
+def size_prefix_size(member: ProtoStructMember) -> int:
+  """Largest encoded size of a size prefix, in bytes."""
+  return {"uint8": 1, "uint16": 2, "uint32": 4, "varint": 5}[size_type(member)]
+
+
+def _integer_bits(t: ProtoType) -> int:
+  return int(t.name.lstrip('uint'))
+
+
+def _primitive_size(t: ProtoType) -> int:
+  if is_integer(t):
+    return _integer_bits(t) // 8
+  return {"bool": 1, "float16": 2, "float32": 4, "float64": 8}[t.name]
+
+
+def _varint_size(t: ProtoType) -> int:
+  return (_integer_bits(t) + 6) // 7
+
+
+class WireSizes:
+  """Smallest and worst case packed sizes of structs and their members.
+
+  Sizes are in bytes, or None if a value has no upper bound,
+  like a string[] which is only ended by a null byte.
+  """
+
+  def __init__(self, enums: List[ProtoEnum], structs: List[ProtoStruct]):
+    self._enums: Dict[str, ProtoEnum] = {enum.name: enum for enum in enums}
+    self._structs: Dict[str, ProtoStruct] = {struct.name: struct for struct in structs}
+
+  def struct_size(self, struct: ProtoStruct) -> Optional[int]:
+    if struct.kind == "union":
+      sizes = [self.member_size(member) for member in struct.members]
+      if None in sizes:
+        return None
+      return 1 + max(sizes, default=0)  # type: ignore
+
+    total = 0
+    for item in bitfield_groups(struct):
+      if isinstance(item, list):
+        total += sum(self._bit_width(member) for member in item) // 8
+        continue
+      size = self.member_size(item)
+      if size is None:
+        return None
+      total += size
+    return total
+
+  def struct_min_size(self, struct: ProtoStruct) -> int:
+    """Smallest packed size of a struct."""
+    if struct.kind == "union":
+      return 1 + min((self.member_min_size(member) for member in struct.members), default=0)
+
+    total = 0
+    for item in bitfield_groups(struct):
+      if isinstance(item, list):
+        total += sum(self._bit_width(member) for member in item) // 8
+      else:
+        total += self.member_min_size(item)
+    return total
+
+  def member_min_size(self, member: ProtoStructMember) -> int:
+    if member.arraySize == 0:
+      return self._min_prefix_size(member)
+    element = self._element_min_size(member)
+    if member.arraySize is None:
+      return element
+    return member.arraySize * element
+
+  def _min_prefix_size(self, member: ProtoStructMember) -> int:
+    return 1 if size_type(member) == "varint" else size_prefix_size(member)
+
+  def _element_min_size(self, member: ProtoStructMember) -> int:
+    t = member.type
+    if t.name in self._structs:
+      return self.struct_min_size(self._structs[t.name])
+    if t.name in self._enums:
+      t = self._enums[t.name].type
+    if t.name in ("bytes", "string"):
+      if t.size:
+        return t.size
+      if t.name == "string" and not has_annotation(member, "prefixed"):
+        return 1  # Just the null terminator
+      return self._min_prefix_size(member)
+    if has_annotation(member, "varint"):
+      return 1
+    scaled = scaled_encoding(member)
+    if scaled is not None:
+      return _primitive_size(scaled.wireType)
+    return _primitive_size(t)
+
+  def is_fixed_size(self, struct: ProtoStruct) -> bool:
+    """True if every value of the struct packs to the same size."""
+    if struct.kind == "union":
+      return False
+
+    for member in struct.members:
+      if member.bitfieldGroup is not None:
+        continue
+      if (
+          has_size_prefix(member)
+          or (member.type.name == "string" and member.type.size == 0)
+          or has_annotation(member, "varint")
+      ):
+        return False
+      if member.type.name in self._structs and not self.is_fixed_size(self._structs[member.type.name]):
+        return False
+    return True
+
+  def member_offsets(self, struct: ProtoStruct) -> Dict[str, int]:
+    """Where each member outside of a bitfield starts in a fixed size struct."""
+    assert self.is_fixed_size(struct)
+    offsets: Dict[str, int] = {}
+    offset = 0
+    for item in bitfield_groups(struct):
+      if isinstance(item, list):
+        offset += sum(self._bit_width(member) for member in item) // 8
+        continue
+      offsets[item.name] = offset
+      offset += self.member_size(item)  # type: ignore
+    return offsets
+
+  def member_size(self, member: ProtoStructMember) -> Optional[int]:
+    element = self._element_size(member)
+    if element is None:
+      return None
+    if member.arraySize is None:
+      return element
+    if member.arraySize > 0:
+      return member.arraySize * element
+    return size_prefix_size(member) + max_count(member) * element
+
+  def _element_size(self, member: ProtoStructMember) -> Optional[int]:
+    t = member.type
+    if t.name in self._structs:
+      return self.struct_size(self._structs[t.name])
+    if t.name in self._enums:
+      t = self._enums[t.name].type
+    if t.name in ("bytes", "string"):
+      if t.size:
+        return t.size
+      if t.name == "string" and not has_annotation(member, "prefixed"):
+        return None
+      return size_prefix_size(member) + max_count(member)
+    if has_annotation(member, "varint"):
+      return _varint_size(t)
+    scaled = scaled_encoding(member)
+    if scaled is not None:
+      return _primitive_size(scaled.wireType)
+    return _primitive_size(t)
+
+  def _bit_width(self, member: ProtoStructMember) -> int:
+    t = member.type
+    if t.name in self._enums:
+      t = self._enums[t.name].type
+    width = bit_width(t)
+    assert width is not None
+    return width
@@ -0,0 +1,113 @@
+/*
+ * Optional native framing and CRCs for the Python runtime.
+ *
+ * Wraps the cpptiny runtime's COBS and CRC code, so both runtimes share
+ * one implementation. bakelite.h is rendered from the cpptiny runtime by
+ * build.py. framing.py and crc.py fall back to pure Python when this
+ * module isn't built.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "bakelite.h"
+
+// Largest COBS encoding of length bytes
+static size_t cobsEncodedSize(size_t length) {
+  return length + length / 254 + 1;
+}
+
+static PyObject *cobsEncode(PyObject *self, PyObject *args) {
+  Py_buffer data;
+  if(!PyArg_ParseTuple(args, "y*", &data)) {
+    return nullptr;
+  }
+
+  // Matches framing.encode, which doesn't encode empty data
+  if(data.len == 0) {
+    PyBuffer_Release(&data);
+    return PyBytes_FromStringAndSize(nullptr, 0);
+  }
+
+  PyObject *output = PyBytes_FromStringAndSize(nullptr, cobsEncodedSize(data.len));
+  if(output == nullptr) {
+    PyBuffer_Release(&data);
+    return nullptr;
+  }
+
+  auto result = Bakelite::cobs_encode(PyBytes_AS_STRING(output), PyBytes_GET_SIZE(output),
+                                      data.buf, data.len);
+  PyBuffer_Release(&data);
+  if(result.status != 0 || _PyBytes_Resize(&output, result.out_len) != 0) {
+    Py_XDECREF(output);
+    PyErr_SetString(PyExc_RuntimeError, "COBS encoding failed");
+    return nullptr;
+  }
+  return output;
+}
+
+// Returns None if the data isn't valid COBS
+static PyObject *cobsDecode(PyObject *self, PyObject *args) {
+  Py_buffer data;
+  if(!PyArg_ParseTuple(args, "y*", &data)) {
+    return nullptr;
+  }
+
+  PyObject *output = PyBytes_FromStringAndSize(nullptr, data.len);
+  if(output == nullptr) {
+    PyBuffer_Release(&data);
+    return nullptr;
+  }
+
+  auto result = Bakelite::cobs_decode(PyBytes_AS_STRING(output), PyBytes_GET_SIZE(output),
+                                      data.buf, data.len);
+  PyBuffer_Release(&data);
+  if(result.status != 0) {
+    Py_DECREF(output);
+    Py_RETURN_NONE;
+  }
+  if(_PyBytes_Resize(&output, result.out_len) != 0) {
+    return nullptr;
+  }
+  return output;
+}
+
+template <class C>
+static PyObject *crc(PyObject *self, PyObject *args) {
+  Py_buffer data;
+  if(!PyArg_ParseTuple(args, "y*", &data)) {
+    return nullptr;
+  }
+
+  C crc;
+  Py_BEGIN_ALLOW_THREADS
+  crc.update((const char *)data.buf, data.len);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&data);
+  return PyLong_FromUnsignedLong(crc.value());
+}
+
+static PyMethodDef methods[] = {
+  { "cobs_encode", cobsEncode, METH_VARARGS, "COBS encode data, without a delimiter" },
+  { "cobs_decode", cobsDecode, METH_VARARGS, "COBS decode data, or None if it isn't valid" },
+  { "crc8", crc<Bakelite::Crc8>, METH_VARARGS, "CRC-8/SMBUS" },
+  { "crc16", crc<Bakelite::Crc16>, METH_VARARGS, "CRC-16/ARC" },
+  { "crc16_ccitt", crc<Bakelite::Crc16Ccitt>, METH_VARARGS, "CRC-16/CCITT-FALSE" },
+  { "crc32", crc<Bakelite::Crc32>, METH_VARARGS, "CRC-32" },
+  { "crc32c", crc<Bakelite::Crc32c>, METH_VARARGS, "CRC-32C" },
+  { "fletcher16", crc<Bakelite::Fletcher16>, METH_VARARGS, "Fletcher-16" },
+  { "fletcher32", crc<Bakelite::Fletcher32>, METH_VARARGS, "Fletcher-32" },
+  { "adler32", crc<Bakelite::Adler32>, METH_VARARGS, "Adler-32" },
+  { nullptr, nullptr, 0, nullptr },
+};
+
+static struct PyModuleDef module = {
+  PyModuleDef_HEAD_INIT,
+  "_native",
+  "Native COBS and CRC functions, from the cpptiny runtime",
+  -1,
+  methods,
+};
+
+PyMODINIT_FUNC PyInit__native(void) {
+  return PyModule_Create(&module);
+}
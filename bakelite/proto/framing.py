@@ -2,6 +2,11 @@ from typing import Callable, Optional
 
 from .crc import CrcSize, crc_funcs
 
+try:
+  from . import _native  # type: ignore
+except ImportError:
+  _native = None
+
 
 class FrameError(RuntimeError):
   pass
@@ -26,6 +31,12 @@ def _append_block(block: bytearray, output: bytearray) -> None:
 
 
 def encode(data: bytes) -> bytes:
+  if _native is not None:
+    return _native.cobs_encode(data)
+  return encode_python(data)
+
+
+def encode_python(data: bytes) -> bytes:
   block = bytearray()
   output = bytearray()
   full_block = False
@@ -50,6 +61,15 @@ def encode(data: bytes) -> bytes:
 
 
 def decode(data: bytes) -> bytes:
+  # The native decoder rejects zeros anywhere, not just in code bytes
+  if _native is not None and 0 not in data:
+    output = _native.cobs_decode(data)
+    if output is not None:
+      return output
+  return decode_python(data)
+
+
+def decode_python(data: bytes) -> bytes:
   output = bytearray()
 
   if not data:
@@ -78,15 +98,15 @@ def decode(data: bytes) -> bytes:
 
 
 def append_crc(data: bytes, crc_size: CrcSize = CrcSize.CRC8) -> bytes:
-  return data + crc_funcs[crc_size](data).to_bytes(crc_size.value, byteorder='little')
+  return data + crc_funcs[crc_size](data).to_bytes(crc_size.size, byteorder='little')
 
 
 def check_crc(data: bytes, crc_size: CrcSize = CrcSize.CRC8) -> bytes:
   if not data:
     raise CRCCheckFailure()
 
-  crc_val = int.from_bytes(data[-crc_size.value:], byteorder='little')
-  output = data[:-crc_size.value]
+  crc_val = int.from_bytes(data[-crc_size.size:], byteorder='little')
+  output = data[:-crc_size.size]
 
   if crc_funcs[crc_size](output) != crc_val:
     raise CRCCheckFailure()
@@ -118,18 +138,19 @@ class Framer:
 
   def decode_frame(self) -> Optional[bytes]:
     while self._buffer:
-      byte = self._buffer.pop(0)
-
-      if byte == 0:
-        if self._frame:
-          try:
-
-            decoded = self._decode_frame_int(self._frame)
-            return decoded
-          finally:
-            self._frame.clear()
-      else:
-        self._frame.append(byte)
+      end = self._buffer.find(0)
+      if end < 0:
+        self._frame.extend(self._buffer)
+        self._buffer.clear()
+        break
+
+      self._frame.extend(self._buffer[:end])
+      del self._buffer[:end + 1]
+      if self._frame:
+        try:
+          return self._decode_frame_int(bytes(self._frame))
+        finally:
+          self._frame.clear()
 
     return None
 
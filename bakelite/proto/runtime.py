@@ -1,4 +1,5 @@
 import struct
+import time
 from dataclasses import is_dataclass
 from enum import Enum
 from io import BufferedIOBase, BytesIO
@@ -12,6 +13,14 @@ class ProtocolError(RuntimeError):
   pass
 
 
+# Fragment frames use the reserved message ID 0:
+# [0] [message ID] [transfer] [index: uint16] [data...]
+# The high bit of the index marks the last fragment.
+FRAGMENT_HEADER_SIZE = 5
+FRAGMENT_LAST = 0x8000
+FRAGMENT_MAX_INDEX = 0x7fff
+
+
 class Registry:
   def __init__(self) -> None:
     self.types: Dict[str, Any] = {}
@@ -41,28 +50,32 @@ class ProtocolBase:
                desc: Union[str, bytes, bytearray],
                crc: str = "CRC8",
                framer: Optional[Framer] = None,
+               fragment_timeout: Optional[float] = None,
                **kwargs: Any) -> None:
     self._stream = stream
     self._registry = registry
     self._desc = Protocol.from_json(desc)
     self._options = kwargs
 
+    self._fragmentation = str(kwargs.get("fragmentation", "false")).lower() == "true"
+    # With maxLength = auto every message fits in one frame
+    max_length = str(kwargs.get("maxLength", "auto"))
+    self._max_length = None if max_length.lower() == "auto" else int(max_length)
+    self._fragment_timeout = fragment_timeout
+    self._transfer = 0
+    self._fragment: Optional[bytearray] = None
+    self._fragment_id = 0
+    self._fragment_transfer = 0
+    self._fragment_next = 0
+    self._fragment_time = 0.0
+
     self._ids = {id.number: id.name for id in self._desc.message_ids}
     self._messages = {id.name: id.number for id in self._desc.message_ids}
 
-    crc_size = CrcSize.NO_CRC
-    crc = crc.lower()
-
-    if crc == "none":
-      crc_size = CrcSize.NO_CRC
-    elif crc == "crc8":
-      crc_size = CrcSize.CRC8
-    elif crc == "crc16":
-      crc_size = CrcSize.CRC16
-    elif crc == "crc32":
-      crc_size = CrcSize.CRC32
-    else:
-      raise RuntimeError(f"Unkown CRC type {crc}")
+    try:
+      crc_size = CrcSize(crc.lower())
+    except ValueError:
+      raise RuntimeError(f"Unkown CRC type {crc}") from None
 
     if not framer:
       self._framer = Framer(crc=crc_size)
@@ -80,18 +93,85 @@ class ProtocolBase:
     msg_id = self._messages[msg_name]
 
     stream = BytesIO()
-    stream.write(struct.pack("=B", msg_id))
     message.pack(stream)
-    frame = self._framer.encode_frame(stream.getvalue())
-
-    self._stream.write(frame)
+    data = stream.getvalue()
+
+    if (
+        self._fragmentation
+        and self._max_length is not None
+        and len(data) > self._max_length
+    ):
+      self._send_fragments(msg_id, data)
+    else:
+      self._stream.write(self._framer.encode_frame(struct.pack("<B", msg_id) + data))
+
+  def _send_fragments(self, msg_id: int, data: bytes) -> None:
+    assert self._max_length is not None
+    chunk_size = max(self._max_length + 1 - FRAGMENT_HEADER_SIZE, 1)
+    count = max((len(data) + chunk_size - 1) // chunk_size, 1)
+    if count > FRAGMENT_MAX_INDEX + 1:
+      raise ProtocolError(f"Message is too large to send in {FRAGMENT_MAX_INDEX + 1} fragments")
+
+    transfer = self._transfer
+    self._transfer = (self._transfer + 1) & 0xFF
+
+    for index in range(count):
+      flags = FRAGMENT_LAST if index == count - 1 else 0
+      chunk = data[index * chunk_size:(index + 1) * chunk_size]
+      header = struct.pack("<BBBH", 0, msg_id, transfer, index | flags)
+      self._stream.write(self._framer.encode_frame(header + chunk))
+
+  def _add_fragment(self, frame: bytes) -> Optional[bytes]:
+    if len(frame) < FRAGMENT_HEADER_SIZE - 1:
+      self._fragment = None
+      return None
+
+    msg_id, transfer, index = struct.unpack("<BBH", frame[:FRAGMENT_HEADER_SIZE - 1])
+    last = (index & FRAGMENT_LAST) != 0
+    index &= FRAGMENT_MAX_INDEX
+
+    if index == 0:
+      self._fragment = bytearray()
+      self._fragment_id = msg_id
+      self._fragment_transfer = transfer
+      self._fragment_next = 0
+
+    if (
+        self._fragment is None
+        or msg_id != self._fragment_id
+        or transfer != self._fragment_transfer
+        or index != self._fragment_next
+    ):
+      # A fragment was lost, drop the message
+      self._fragment = None
+      return None
+
+    self._fragment += frame[FRAGMENT_HEADER_SIZE - 1:]
+    self._fragment_next += 1
+    self._fragment_time = time.monotonic()
+
+    if last:
+      data = bytes([msg_id]) + self._fragment
+      self._fragment = None
+      return data
+    return None
 
   def poll(self) -> Any:
+    if (
+        self._fragment is not None
+        and self._fragment_timeout is not None
+        and time.monotonic() - self._fragment_time > self._fragment_timeout
+    ):
+      self._fragment = None
+
     data = self._stream.read()
     self._framer.append_buffer(data)
 
     frame = self._framer.decode_frame()
 
+    if frame and self._fragmentation and frame[0] == 0:
+      frame = self._add_fragment(frame[1:])
+
     if frame:
       msg_id = frame[0]
       msg = frame[1:]
@@ -1,16 +1,25 @@
+import math
 import struct as pystruct
 from dataclasses import is_dataclass
 from enum import Enum
 from functools import partial
 from io import BufferedIOBase
-from typing import Any, Generic, Type, TypeVar, cast
+from operator import attrgetter
+from typing import Any, Callable, Dict, Generic, List, Optional, Sequence, Type, TypeVar, Union, cast
 
 from ..generator.types import (
     ProtoEnum,
     ProtoStruct,
     ProtoStructMember,
     ProtoType,
+    ScaledEncoding,
+    bit_width,
+    bitfield_groups,
+    has_annotation,
+    is_bit_type,
     is_primitive,
+    scaled_encoding,
+    size_type,
 )
 from .runtime import Registry
 
@@ -37,9 +46,16 @@ def _pack_type(
       )
 
 
+def _pack_float16(value: float) -> float:
+  # Match the C++ runtime, which saturates to infinity
+  if math.isfinite(value) and abs(value) >= 65520.0:
+    return math.copysign(math.inf, value)
+  return value
+
+
 def _pack_primitive_type(stream: BufferedIOBase, value: Any, t: ProtoType) -> None:
   data: bytes = b''
-  format_str: str = '='
+  format_str: str = '<'
 
   if t.name == "bool":
     format_str += "?"
@@ -59,6 +75,9 @@ def _pack_primitive_type(stream: BufferedIOBase, value: Any, t: ProtoType) -> No
     format_str += "q"
   elif t.name == "uint64":
     format_str += "Q"
+  elif t.name == "float16":
+    format_str += "e"
+    value = _pack_float16(value)
   elif t.name == "float32":
     format_str += "f"
   elif t.name == "float64":
@@ -70,7 +89,7 @@ def _pack_primitive_type(stream: BufferedIOBase, value: Any, t: ProtoType) -> No
       raise SerializationError(
           f'value is {len(value)}, but must be no longer than 255'
       )
-    stream.write(pystruct.pack('=B', len(value)))
+    stream.write(pystruct.pack('<B', len(value)))
     stream.write(value)
     return
   elif t.name == "bytes":
@@ -133,7 +152,7 @@ def _unpack_type(stream: BufferedIOBase, t: ProtoType, registry: Registry) -> An
 
 def _unpack_primitive_type(stream: BufferedIOBase, t: ProtoType) -> Any:
   data: bytes = b''
-  format_str: str = '='
+  format_str: str = '<'
 
   if t.name == "bool":
     format_str += "?"
@@ -153,12 +172,14 @@ def _unpack_primitive_type(stream: BufferedIOBase, t: ProtoType) -> Any:
     format_str += "q"
   elif t.name == "uint64":
     format_str += "Q"
+  elif t.name == "float16":
+    format_str += "e"
   elif t.name == "float32":
     format_str += "f"
   elif t.name == "float64":
     format_str += "d"
   elif t.name == "bytes" and t.size == 0:
-    size = pystruct.unpack('=B', stream.read(1))[0]
+    size = pystruct.unpack('<B', stream.read(1))[0]
     data = stream.read(size)
     return data
   elif t.name == "bytes":
@@ -186,50 +207,638 @@ def _unpack_primitive_type(stream: BufferedIOBase, t: ProtoType) -> Any:
   return value
 
 
-def pack(self: Any, stream: BufferedIOBase) -> None:
-  member: ProtoStructMember
-  for member in self._desc.members:
-    value = getattr(self, member.name)
-    if member.arraySize is None:
-      _pack_type(stream, value, member.type, self._registry)
+def _int_bits(t: ProtoType) -> int:
+  return int(t.name.lstrip('uint'))
+
+
+def _is_signed(t: ProtoType) -> bool:
+  return not t.name.startswith('u')
+
+
+def _to_signed(value: int, bits: int) -> int:
+  value &= (1 << bits) - 1
+  return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def _zigzag_encode(value: int, bits: int) -> int:
+  return ((value << 1) ^ (value >> (bits - 1))) & ((1 << bits) - 1)
+
+
+def _zigzag_decode(value: int) -> int:
+  return (value >> 1) ^ -(value & 1)
+
+
+def _write_varint(stream: BufferedIOBase, value: int) -> None:
+  data = bytearray()
+  while True:
+    byte = value & 0x7F
+    value >>= 7
+    if value:
+      data.append(byte | 0x80)
+    else:
+      data.append(byte)
+      break
+  stream.write(data)
+
+
+def _read_varint(stream: BufferedIOBase, bits: int) -> int:
+  value = 0
+  for shift in range(0, bits, 7):
+    data = stream.read(1)
+    if not data:
+      raise SerializationError("Unexpected end of data while reading varint")
+    value |= (data[0] & 0x7F) << shift
+    if not data[0] & 0x80:
+      return value & ((1 << bits) - 1)
+
+  raise SerializationError(f"varint is too long for a {bits} bit value")
+
+
+def _pack_varint(stream: BufferedIOBase, value: int, t: ProtoType) -> None:
+  bits = _int_bits(t)
+  if _is_signed(t):
+    _write_varint(stream, _zigzag_encode(value, bits))
+  else:
+    _write_varint(stream, value)
+
+
+def _unpack_varint(stream: BufferedIOBase, t: ProtoType) -> int:
+  bits = _int_bits(t)
+  value = _read_varint(stream, bits)
+  if _is_signed(t):
+    return _to_signed(_zigzag_decode(value), bits)
+  return value
+
+
+def _pack_delta(stream: BufferedIOBase, values: Any, member: ProtoStructMember) -> None:
+  bits = _int_bits(member.type)
+  varint = has_annotation(member, "varint")
+  diff_type = ProtoType(name=f"uint{bits}", size=0)
+  prev = 0
+
+  for value in values:
+    diff = (value - prev) & ((1 << bits) - 1)
+    prev = value
+    if varint:
+      # Differences are signed, even for unsigned types
+      _write_varint(stream, _zigzag_encode(_to_signed(diff, bits), bits))
+    else:
+      _pack_primitive_type(stream, diff, diff_type)
+
+
+def _unpack_delta(stream: BufferedIOBase, size: int, member: ProtoStructMember) -> Any:
+  bits = _int_bits(member.type)
+  varint = has_annotation(member, "varint")
+  diff_type = ProtoType(name=f"uint{bits}", size=0)
+  signed = _is_signed(member.type)
+  values = []
+  acc = 0
+
+  for _i in range(0, size):
+    if varint:
+      diff = _zigzag_decode(_read_varint(stream, bits))
+    else:
+      diff = _unpack_primitive_type(stream, diff_type)
+    acc = (acc + diff) & ((1 << bits) - 1)
+    values.append(_to_signed(acc, bits) if signed else acc)
+
+  return values
+
+
+def _member_bit_width(member: ProtoStructMember, registry: Registry) -> int:
+  if is_primitive(member.type) or is_bit_type(member.type):
+    width = bit_width(member.type)
+  else:
+    # Enums use the width of their underlying type
+    width = bit_width(registry.get(member.type.name)._desc.type)
+  assert width is not None
+  return width
+
+
+def _pack_bitfield(stream: BufferedIOBase, obj: Any,
+                   members: List[ProtoStructMember], registry: Registry) -> None:
+  bits = 0
+  shift = 0
+
+  for member in members:
+    width = _member_bit_width(member, registry)
+    if member.type.name != "unused":
+      value = getattr(obj, member.name)
+      if isinstance(value, Enum):
+        value = value.value
+      bits |= (int(value) & ((1 << width) - 1)) << shift
+    shift += width
+
+  stream.write(bits.to_bytes(shift // 8, byteorder='little'))
+
+
+def _unpack_bitfield(stream: BufferedIOBase, members: List[ProtoStructMember],
+                     registry: Registry) -> Dict[str, Any]:
+  widths = [_member_bit_width(member, registry) for member in members]
+  bits = int.from_bytes(stream.read(sum(widths) // 8), byteorder='little')
+  values: Dict[str, Any] = {}
+
+  for member, width in zip(members, widths):
+    value = bits & ((1 << width) - 1)
+    bits >>= width
+
+    if member.type.name == "unused":
+      continue
+    elif member.type.name in ("flag", "bool"):
+      values[member.name] = bool(value)
+    elif member.type.name == "int" or member.type.name.startswith("int"):
+      values[member.name] = _to_signed(value, width)
+    elif is_primitive(member.type) or member.type.name == "uint":
+      values[member.name] = value
+    else:
+      values[member.name] = registry.get(member.type.name)(value)
+
+  return values
+
+
+def _pack_prefixed_string(stream: BufferedIOBase, value: bytes, member: ProtoStructMember) -> None:
+  if value[-1:] == b'\0':
+    value = value[:-1]
+  if value.find(b'\x00') >= 0:
+    raise SerializationError("Found a null byte before the end of the string")
+  _pack_size(stream, len(value), member)
+  stream.write(value)
+
+
+def _quantizer(scaled: ScaledEncoding) -> Callable[[float], int]:
+  """Returns a function that quantizes values for a scaled encoding."""
+  bits = _int_bits(scaled.wireType)
+  if _is_signed(scaled.wireType):
+    lo, hi = -(1 << (bits - 1)), (1 << (bits - 1)) - 1
+  else:
+    lo, hi = 0, (1 << bits) - 1
+  offset = scaled.offset
+  inverse = 1 / scaled.scale
+
+  def quantize(value: float) -> int:
+    if value != value:  # NaN
+      return 0
+
+    x = (value - offset) * inverse
+    if math.isinf(x):
+      return hi if x > 0 else lo
+    # Round half away from zero, like the C++ runtime
+    rounded = math.floor(x + 0.5) if x >= 0 else math.ceil(x - 0.5)
+    return lo if rounded < lo else hi if rounded > hi else rounded
+
+  return quantize
+
+
+def _quantize(value: float, scaled: ScaledEncoding) -> int:
+  return _quantizer(scaled)(value)
+
+
+def _dequantize(value: int, scaled: ScaledEncoding) -> float:
+  return value * scaled.scale + scaled.offset
+
+
+def _pack_member(stream: BufferedIOBase, value: Any, member: ProtoStructMember, registry: Registry) -> None:
+  scaled = scaled_encoding(member)
+  if scaled is not None:
+    _pack_primitive_type(stream, _quantize(value, scaled), scaled.wireType)
+  elif has_annotation(member, "prefixed"):
+    _pack_prefixed_string(stream, value, member)
+  elif member.type.name == "bytes" and member.type.size == 0:
+    if not isinstance(value, bytes):
+      raise SerializationError(f'expected bytes object for field {member.name}')
+    _pack_size(stream, len(value), member)
+    stream.write(value)
+  elif has_annotation(member, "varint"):
+    _pack_varint(stream, value, member.type)
+  else:
+    _pack_type(stream, value, member.type, registry)
+
+
+def _unpack_member(stream: BufferedIOBase, member: ProtoStructMember, registry: Registry) -> Any:
+  scaled = scaled_encoding(member)
+  if scaled is not None:
+    return _dequantize(_unpack_primitive_type(stream, scaled.wireType), scaled)
+  if has_annotation(member, "prefixed") or (
+      member.type.name == "bytes" and member.type.size == 0
+  ):
+    return stream.read(_unpack_size(stream, member))
+  if has_annotation(member, "varint"):
+    return _unpack_varint(stream, member.type)
+  return _unpack_type(stream, member.type, registry)
+
+
+def _pack_size(stream: BufferedIOBase, size: int, member: ProtoStructMember) -> None:
+  prefix = size_type(member)
+  if prefix == "varint":
+    max_size = (1 << 32) - 1
+  else:
+    max_size = (1 << _int_bits(ProtoType(name=prefix, size=0))) - 1
+
+  if size > max_size:
+    raise SerializationError(
+        f"{member.name} has {size} elements, but must not exceed {max_size}"
+    )
+
+  if prefix == "varint":
+    _write_varint(stream, size)
+  else:
+    _pack_primitive_type(stream, size, ProtoType(name=prefix, size=0))
+
+
+def _unpack_size(stream: BufferedIOBase, member: ProtoStructMember) -> int:
+  prefix = size_type(member)
+  if prefix == "varint":
+    return _read_varint(stream, 32)
+  return _unpack_primitive_type(stream, ProtoType(name=prefix, size=0))
+
+
+def _pack_field(stream: BufferedIOBase, value: Any, member: ProtoStructMember, registry: Registry) -> None:
+  if member.arraySize is None:
+    _pack_member(stream, value, member, registry)
+  else:
+    if member.arraySize != 0:
+      if len(value) != member.arraySize:
+        raise SerializationError(
+            f"Expected {member.arraySize} elements in array, got {len(value)}"
+        )
+    else:
+      _pack_size(stream, len(value), member)
+    if has_annotation(member, "delta"):
+      _pack_delta(stream, value, member)
     else:
-      if member.arraySize != 0:
-        if len(value) != member.arraySize:
-          raise SerializationError(
-              f"Expected {member.arraySize} elements in array, got {len(value)}"
-          )
-      else:
-        if len(value) > 255:
-          raise SerializationError(
-              f"Got an array of size {len(value)}. Arrays must not exceed 255 elements"
-          )
-        stream.write(pystruct.pack('=B', len(value)))
       for element in value:
-        _pack_type(stream, element, member.type, self._registry)
+        _pack_member(stream, element, member, registry)
+
+
+def _unpack_field(stream: BufferedIOBase, member: ProtoStructMember, registry: Registry) -> Any:
+  if member.arraySize is None:
+    return _unpack_member(stream, member, registry)
+
+  value = []
+  size = member.arraySize
+
+  if size == 0:
+    size = _unpack_size(stream, member)
+
+  if has_annotation(member, "delta"):
+    value = _unpack_delta(stream, size, member)
+  else:
+    for _i in range(0, size):
+      value.append(_unpack_member(stream, member, registry))
+  return value
+
+
+# Struct layouts
+#
+# Runs of fixed size members are packed and unpacked with one precompiled
+# struct.Struct call. A struct made only of fixed size members is a single
+# run, so it takes one call per message. Variable length arrays of fixed
+# size elements take one call per array. Everything else, variable length
+# strings and bytes, varints, delta arrays and bitfields, is serialized
+# member by member as above. Layouts are compiled the first time a struct is packed
+# or unpacked, once every type it refers to has been registered.
+
+_FORMATS = {
+    "bool": "?",
+    "int8": "b",
+    "uint8": "B",
+    "int16": "h",
+    "uint16": "H",
+    "int32": "i",
+    "uint32": "I",
+    "int64": "q",
+    "uint64": "Q",
+    "float16": "e",
+    "float32": "f",
+    "float64": "d",
+}
+
+
+class _Field:
+  """A fixed size member, as count values in a struct.Struct format.
+
+  A plain field is a single value that's packed as is, so it doesn't need
+  to_wire or from_wire.
+  """
+
+  def __init__(self, fmt: str, count: int = 1,
+               to_wire: Optional[Callable[[Any], Sequence[Any]]] = None,
+               from_wire: Optional[Callable[[Sequence[Any]], Any]] = None) -> None:
+    self.fmt = fmt
+    self.count = count
+    self.to_wire = to_wire
+    self.from_wire = from_wire
+    self.plain = to_wire is None
+
+
+def _scalar_field(fmt: str, to_wire: Callable[[Any], Any],
+                  from_wire: Callable[[Any], Any]) -> _Field:
+  return _Field(fmt, 1, lambda value: (to_wire(value),), lambda items: from_wire(items[0]))
+
+
+def _fixed_bytes_field(size: int) -> _Field:
+  def to_wire(value: bytes) -> bytes:
+    if len(value) > size:
+      raise SerializationError(
+          f'value is {len(value)}, but must be no longer than {size}'
+      )
+    return value
+
+  return _scalar_field(f'{size}s', to_wire, lambda data: data)
+
+
+def _fixed_string_field(size: int) -> _Field:
+  def to_wire(value: bytes) -> bytes:
+    if not isinstance(value, bytes):
+      raise SerializationError('string values must be encoded as bytes')
+    if len(value) >= size:
+      raise SerializationError(
+          f'value is {len(value)}, but must be no longer than {size}, with room for a null byte'
+      )
+    return value
+
+  # Return characters up untill the null byte
+  return _scalar_field(f'{size}s', to_wire, lambda data: data[: data.find(b'\00')])
+
+
+def _array_field(element: _Field, size: int) -> _Field:
+  count = element.count
+
+  def to_wire(values: Sequence[Any]) -> Sequence[Any]:
+    if len(values) != size:
+      raise SerializationError(
+          f"Expected {size} elements in array, got {len(values)}"
+      )
+    if element.plain:
+      return values
+    items: List[Any] = []
+    for value in values:
+      items.extend(element.to_wire(value))  # type: ignore
+    return items
+
+  def from_wire(items: Sequence[Any]) -> List[Any]:
+    if element.plain:
+      return list(items)
+    return [
+        element.from_wire(items[i:i + count])  # type: ignore
+        for i in range(0, len(items), count)
+    ]
+
+  if element.plain:
+    fmt = f'{size}{element.fmt}'
+  else:
+    fmt = element.fmt * size
+  return _Field(fmt, count * size, to_wire, from_wire)
+
+
+def _element_field(member: ProtoStructMember, registry: Registry) -> Optional[_Field]:
+  t = member.type
+  scaled = scaled_encoding(member)
+  if scaled is not None:
+    scale, offset = scaled.scale, scaled.offset
+    return _scalar_field(
+        _FORMATS[scaled.wireType.name],
+        _quantizer(scaled),
+        lambda value: value * scale + offset,
+    )
+
+  if t.name == "float16":
+    return _scalar_field("e", _pack_float16, lambda value: value)
+  if t.name in _FORMATS:
+    return _Field(_FORMATS[t.name])
+  if t.name == "bytes" and t.size:
+    return _fixed_bytes_field(t.size)
+  if t.name == "string" and t.size:
+    return _fixed_string_field(t.size)
+  if is_primitive(t) or t.name not in registry.types:
+    return None
+
+  cls = registry.get(t.name)
+  if registry.is_enum(t.name):
+    fmt = _FORMATS.get(cls._desc.type.name)
+    if fmt is None:
+      return None
+    return _scalar_field(fmt, lambda value: value.value, cls)
+
+  # Nested structs are flattened into the parent, if they're fixed size
+  if cls._desc.kind == "union":
+    return None
+  layout = _layout(cls)
+  if len(layout) != 1 or not isinstance(layout[0], _Run):
+    return None
+  run = layout[0]
+  return _Field(
+      run.struct.format[1:], run.count, run.to_wire,
+      lambda items: cls(**run.from_wire(items)),
+  )
+
+
+def _member_field(member: ProtoStructMember, registry: Registry) -> Optional[_Field]:
+  if (
+      has_annotation(member, "varint")
+      or has_annotation(member, "delta")
+      or has_annotation(member, "prefixed")
+      or member.arraySize == 0
+  ):
+    return None
+
+  element = _element_field(member, registry)
+  if element is None or member.arraySize is None:
+    return element
+  return _array_field(element, member.arraySize)
+
+
+class _Run:
+  """Consecutive fixed size members, packed with one struct.Struct."""
+
+  def __init__(self, names: List[str], fields: List[_Field]) -> None:
+    self.names = names
+    self.fields = fields
+    self.struct = pystruct.Struct('<' + ''.join(field.fmt for field in fields))
+    self.count = sum(field.count for field in fields)
+    self.plain = all(field.plain for field in fields)
+    self._get = attrgetter(*names)
+
+  def to_wire(self, obj: Any) -> Sequence[Any]:
+    if self.plain:
+      values = self._get(obj)
+      return values if len(self.names) > 1 else (values,)
+
+    items: List[Any] = []
+    for name, field in zip(self.names, self.fields):
+      value = getattr(obj, name)
+      if field.plain:
+        items.append(value)
+      else:
+        items.extend(field.to_wire(value))  # type: ignore
+    return items
+
+  def from_wire(self, items: Sequence[Any]) -> Dict[str, Any]:
+    if self.plain:
+      return dict(zip(self.names, items))
+
+    values: Dict[str, Any] = {}
+    pos = 0
+    for name, field in zip(self.names, self.fields):
+      if field.plain:
+        values[name] = items[pos]
+      else:
+        values[name] = field.from_wire(items[pos:pos + field.count])  # type: ignore
+      pos += field.count
+    return values
+
+  def pack(self, stream: BufferedIOBase, obj: Any) -> None:
+    stream.write(self.struct.pack(*self.to_wire(obj)))
+
+  def unpack(self, stream: BufferedIOBase) -> Dict[str, Any]:
+    return self.from_wire(self.struct.unpack(stream.read(self.struct.size)))
+
+
+class _Array:
+  """A variable length array of fixed size elements.
+
+  Plain elements are packed with one struct call, others one element at a
+  time with a precompiled struct.Struct.
+  """
+
+  def __init__(self, member: ProtoStructMember, element: _Field) -> None:
+    self.member = member
+    self.name = member.name
+    self.element = element
+    self.struct = pystruct.Struct('<' + element.fmt)
+
+  def pack(self, stream: BufferedIOBase, obj: Any) -> None:
+    values = getattr(obj, self.name)
+    _pack_size(stream, len(values), self.member)
+    if self.element.plain:
+      stream.write(pystruct.pack(f'<{len(values)}{self.element.fmt}', *values))
+    else:
+      to_wire = self.element.to_wire
+      stream.write(b''.join(self.struct.pack(*to_wire(value)) for value in values))  # type: ignore
+
+  def unpack(self, stream: BufferedIOBase) -> Dict[str, Any]:
+    size = _unpack_size(stream, self.member)
+    data = stream.read(size * self.struct.size)
+    if self.element.plain:
+      return {self.name: list(pystruct.unpack(f'<{size}{self.element.fmt}', data))}
+    from_wire = self.element.from_wire
+    return {self.name: [from_wire(items) for items in self.struct.iter_unpack(data)]}  # type: ignore
+
+
+_Step = Union[_Run, _Array, ProtoStructMember, List[ProtoStructMember]]
+
+
+def _array(member: Union[ProtoStructMember, List[ProtoStructMember]],
+           registry: Registry) -> Optional[_Array]:
+  if (
+      isinstance(member, list)
+      or member.arraySize != 0
+      or has_annotation(member, "varint")
+      or has_annotation(member, "delta")
+  ):
+    return None
+
+  element = _element_field(member, registry)
+  if element is None:
+    return None
+  return _Array(member, element)
+
+
+def _compile(desc: ProtoStruct, registry: Registry) -> List[_Step]:
+  steps: List[_Step] = []
+  names: List[str] = []
+  fields: List[_Field] = []
+
+  for member in bitfield_groups(desc):
+    field = None if isinstance(member, list) else _member_field(member, registry)
+    if field is not None:
+      names.append(member.name)  # type: ignore
+      fields.append(field)
+      continue
+
+    if fields:
+      steps.append(_Run(names, fields))
+      names, fields = [], []
+    steps.append(_array(member, registry) or member)  # type: ignore
+
+  if fields:
+    steps.append(_Run(names, fields))
+  return steps
+
+
+def _layout(cls: Any) -> List[_Step]:
+  layout = cls.__dict__.get('_layout')
+  if layout is None:
+    layout = _compile(cls._desc, cls._registry)
+    cls._layout = layout
+  return layout
+
+
+def pack(self: Any, stream: BufferedIOBase) -> None:
+  for step in _layout(type(self)):
+    if isinstance(step, (_Run, _Array)):
+      step.pack(stream, self)
+    elif isinstance(step, list):
+      _pack_bitfield(stream, self, step, self._registry)
+    else:
+      _pack_field(stream, getattr(self, step.name), step, self._registry)
 
 
 TUnpack = TypeVar("TUnpack", bound=object)
 
 
 def unpack(cls: Type[TUnpack], stream: BufferedIOBase) -> TUnpack:
-  members = {}
-  member: ProtoStructMember
-  for member in cls._desc.members:  # type: ignore
-    if member.arraySize is None:
-      members[member.name] = _unpack_type(
-          stream, member.type, cls._registry)  # type: ignore
+  layout = _layout(cls)
+  if len(layout) == 1 and isinstance(layout[0], _Run):
+    return cls(**layout[0].unpack(stream))
+
+  members: Dict[str, Any] = {}
+  for step in layout:
+    if isinstance(step, (_Run, _Array)):
+      members.update(step.unpack(stream))
+    elif isinstance(step, list):
+      members.update(_unpack_bitfield(stream, step, cls._registry))  # type: ignore
     else:
-      value = []
-      size = member.arraySize
+      members[step.name] = _unpack_field(stream, step, cls._registry)  # type: ignore
 
-      if size == 0:
-        size = pystruct.unpack('=B', stream.read(1))[0]
+  return cls(**members)
 
-      for _i in range(0, size):
-        value.append(_unpack_type(stream, member.type, cls._registry))  # type: ignore
-      members[member.name] = value
 
-  return cls(**members)
+# Unions are written as a uint8 tag followed by the active member.
+# Tag 0 is an empty union, members are numbered from 1 in declaration order.
+def pack_union(self: Any, stream: BufferedIOBase) -> None:
+  active = [
+      (tag, member) for tag, member in enumerate(self._desc.members, 1)
+      if getattr(self, member.name) is not None
+  ]
+
+  if len(active) > 1:
+    names = ', '.join(member.name for _tag, member in active)
+    raise SerializationError(f"Only one union member can be set, got {names}")
+
+  if not active:
+    stream.write(pystruct.pack('<B', 0))
+    return
+
+  tag, member = active[0]
+  stream.write(pystruct.pack('<B', tag))
+  _pack_field(stream, getattr(self, member.name), member, self._registry)
+
+
+def unpack_union(cls: Type[TUnpack], stream: BufferedIOBase) -> TUnpack:
+  desc: ProtoStruct = cls._desc  # type: ignore
+  data = stream.read(1)
+  if not data:
+    raise SerializationError("Unexpected end of data while reading union tag")
+
+  tag = data[0]
+  if tag == 0:
+    return cls()
+  if tag > len(desc.members):
+    raise SerializationError(f"Invalid tag {tag} for union {desc.name}")
+
+  member = desc.members[tag - 1]
+  return cls(**{member.name: _unpack_field(stream, member, cls._registry)})  # type: ignore
 
 
 T = TypeVar('T')
@@ -271,6 +880,30 @@ class struct:
     return new_cls
 
 
+class union:
+  def __init__(self, registry: Registry, json_desc: str) -> None:
+    self.json_desc = json_desc
+    self.registry = registry
+
+  def __call__(self, cls: T) -> Packable[T]:
+    if not is_dataclass(cls):
+      raise SerializationError(f'{cls} is not a dataclass')
+
+    new_cls = cast(Packable[T], cls)
+
+    desc: ProtoStruct
+    desc = ProtoStruct.from_json(self.json_desc)
+
+    setattr(new_cls, 'pack', pack_union)
+    setattr(new_cls, 'unpack', partial(unpack_union, new_cls))
+    new_cls._desc = desc
+    new_cls._registry = self.registry
+
+    self.registry.register(desc.name, new_cls)
+
+    return new_cls
+
+
 class enum:
   def __init__(self, registry: Registry, json_desc: str) -> None:
     self.json_desc = json_desc
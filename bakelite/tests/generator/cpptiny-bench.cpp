@@ -0,0 +1,376 @@
+/*
+ * Microbenchmarks for the cpptiny runtime.
+ *
+ *   ./cpptiny-bench [--json results.json] [--filter name] [--time seconds]
+ *
+ * Each benchmark is calibrated to run for roughly --time seconds, and
+ * reports ns/op, MB/s of wire data and bytes per op taken from the
+ * BufferStream heap.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bench.h"
+
+using namespace std;
+using namespace Bakelite;
+
+/*
+ * Harness
+ */
+template <class T>
+static inline void doNotOptimize(T const &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult {
+  string name;
+  uint64_t iterations;
+  double nsPerOp;
+  double mbPerSec;
+  double heapBytesPerOp;
+};
+
+static vector<BenchResult> results;
+static const char *filter = nullptr;
+static double minTime = 0.2;
+
+// Ops that unpack into a heap add BufferStream::heapUsed() to this
+static size_t heapBytes = 0;
+
+// fn runs one op, and bytes is the amount of wire data it handles
+template <class Fn>
+static void bench(const char *name, size_t bytes, Fn fn) {
+  using Clock = chrono::steady_clock;
+
+  if(filter != nullptr && strstr(name, filter) == nullptr) {
+    return;
+  }
+
+  uint64_t iterations = 1;
+  double elapsed = 0;
+  size_t heap = 0;
+  for(;;) {
+    size_t startHeap = heapBytes;
+    auto start = Clock::now();
+    for(uint64_t i = 0; i < iterations; i++) {
+      fn();
+    }
+    elapsed = chrono::duration<double>(Clock::now() - start).count();
+    heap = heapBytes - startHeap;
+
+    if(elapsed >= minTime) {
+      break;
+    }
+    // Aim a little past minTime, so the next run is usually the last
+    double scale = elapsed > 0 ? minTime * 1.2 / elapsed : 100;
+    iterations = (uint64_t)(iterations * (scale < 100 ? scale : 100)) + 1;
+  }
+
+  BenchResult result;
+  result.name = name;
+  result.iterations = iterations;
+  result.nsPerOp = elapsed * 1e9 / iterations;
+  result.mbPerSec = bytes * iterations / elapsed / 1e6;
+  result.heapBytesPerOp = (double)heap / iterations;
+  results.push_back(result);
+
+  printf("%-32s %12.1f ns/op %10.1f MB/s %8.1f heap B/op\n",
+    name, result.nsPerOp, result.mbPerSec, result.heapBytesPerOp);
+}
+
+static int writeJson(const char *path) {
+  FILE *file = fopen(path, "w");
+  if(file == nullptr) {
+    perror(path);
+    return 1;
+  }
+
+  fprintf(file, "{\n  \"benchmarks\": [\n");
+  for(size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    fprintf(file,
+      "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, "
+      "\"mb_per_sec\": %.3f, \"heap_bytes_per_op\": %.3f}%s\n",
+      r.name.c_str(), (unsigned long long)r.iterations, r.nsPerOp,
+      r.mbPerSec, r.heapBytesPerOp, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return 0;
+}
+
+/*
+ * In-memory transport for the protocol round trip
+ */
+static char wire[4096];
+static size_t wireWritePos = 0;
+static size_t wireReadPos = 0;
+
+static size_t wireWrite(const char *data, size_t length) {
+  if(wireReadPos == wireWritePos) {
+    wireReadPos = wireWritePos = 0;
+  }
+  if(wireWritePos + length > sizeof(wire)) {
+    return 0;
+  }
+  memcpy(wire + wireWritePos, data, length);
+  wireWritePos += length;
+  return length;
+}
+
+static int wireRead() {
+  if(wireReadPos == wireWritePos) {
+    return -1;
+  }
+  return (uint8_t)wire[wireReadPos++];
+}
+
+/*
+ * Benchmarks
+ */
+template <class T>
+static void benchStruct(const char *packName, const char *unpackName, const T &value) {
+  static char data[2048];
+  static char heap[2048];
+
+  BufferStream sizing(data, sizeof(data));
+  if(value.pack(sizing) != 0) {
+    fprintf(stderr, "%s: pack failed\n", packName);
+    exit(1);
+  }
+  size_t size = sizing.pos();
+
+  bench(packName, size, [&]() {
+    BufferStream stream(data, sizeof(data));
+    doNotOptimize(value.pack(stream));
+  });
+
+  bench(unpackName, size, [&]() {
+    BufferStream stream(data, size, heap, sizeof(heap));
+    T result;
+    doNotOptimize(result.unpack(stream));
+    doNotOptimize(result);
+    heapBytes += stream.heapUsed();
+  });
+}
+
+static void benchStructs() {
+  Telemetry telemetry = { 1234, 1650000000000ull, Mode::Running, 12.5f, 0.75f, 215, "motor-1" };
+  benchStruct("pack/fixed", "unpack/fixed", telemetry);
+
+  static int32_t values[64];
+  static float gains[64];
+  for(int i = 0; i < 64; i++) {
+    values[i] = i * 1000 - 20000;
+    gains[i] = i * 0.25f;
+  }
+  Samples samples = { 3, { values, 64 }, { gains, 64 } };
+  benchStruct("pack/arrays", "unpack/arrays", samples);
+
+  LogLine line = { 2, (char *)"controller", (char *)"Motor current above threshold, reducing speed" };
+  benchStruct("pack/strings", "unpack/strings", line);
+
+  Path path;
+  path.id = 7;
+  path.start = { 0, 0, 0 };
+  path.end = { 1000, -1000, 50 };
+  for(int i = 0; i < 16; i++) {
+    path.waypoints[i] = { i * 10, i * -10, i };
+  }
+  benchStruct("pack/nested", "unpack/nested", path);
+}
+
+// Unpacking a batch of messages into a column per member, compared with
+// unpacking each message and copying its members into the columns
+static void benchColumns() {
+  const size_t count = 1024;
+  const size_t size = Telemetry::maxPackedSize();
+  static char packed[count][Telemetry::maxPackedSize()];
+  static const char *messages[count];
+  static size_t lengths[count];
+  for(size_t i = 0; i < count; i++) {
+    Telemetry telemetry = { (uint32_t)i, 1650000000000ull + i, Mode::Running, 12.5f, i * 0.01f, (int16_t)i, "motor-1" };
+    BufferStream stream(packed[i], size);
+    telemetry.pack(stream);
+    messages[i] = packed[i];
+    lengths[i] = size;
+  }
+
+  static uint32_t sequence[count];
+  static uint64_t timestamp[count];
+  static float voltage[count];
+  static float current[count];
+  static int16_t temperature[count];
+
+  bench("unpack/rows/1024", size * count, [&]() {
+    for(size_t i = 0; i < count; i++) {
+      BufferStream stream((char *)messages[i], lengths[i]);
+      Telemetry result;
+      doNotOptimize(result.unpack(stream));
+      sequence[i] = result.sequence;
+      timestamp[i] = result.timestamp;
+      voltage[i] = result.voltage;
+      current[i] = result.current;
+      temperature[i] = result.temperature;
+    }
+    doNotOptimize(temperature);
+  });
+
+  Telemetry::Columns columns;
+  columns.sequence = sequence;
+  columns.timestamp = timestamp;
+  columns.voltage = voltage;
+  columns.current = current;
+  columns.temperature = temperature;
+  bench("unpack/columns/1024", size * count, [&]() {
+    doNotOptimize(Telemetry::unpackColumns(columns, messages, lengths, count));
+    doNotOptimize(temperature);
+  });
+}
+
+static void benchCobs() {
+  const size_t size = 256;
+  static char input[size];
+  static char encoded[size + 8];
+  static char decoded[size + 8];
+  for(size_t i = 0; i < size; i++) {
+    input[i] = (char)(i * 7);
+  }
+
+  auto encodedLength = cobs_encode(encoded, sizeof(encoded), input, size).out_len;
+
+  bench("cobs_encode/256", size, [&]() {
+    doNotOptimize(cobs_encode(encoded, sizeof(encoded), input, size));
+  });
+  bench("cobs_decode/256", size, [&]() {
+    doNotOptimize(cobs_decode(decoded, sizeof(decoded), encoded, encodedLength));
+  });
+}
+
+template <class C>
+static void benchCrc(const char *name, const char *data, size_t size) {
+  bench(name, size, [&]() {
+    C crc;
+    crc.update(data, size);
+    doNotOptimize(crc.value());
+  });
+}
+
+static void benchCrcs() {
+  const size_t size = 4096;
+  static char data[size];
+  for(size_t i = 0; i < size; i++) {
+    data[i] = (char)(i * 13 + 5);
+  }
+
+  benchCrc<Crc8>("crc8/4096", data, size);
+  benchCrc<Crc16>("crc16/4096", data, size);
+  benchCrc<Crc16Ccitt>("crc16_ccitt/4096", data, size);
+  benchCrc<Crc32>("crc32/4096", data, size);
+  benchCrc<Crc32c>("crc32c/4096", data, size);
+  benchCrc<Fletcher16>("fletcher16/4096", data, size);
+  benchCrc<Fletcher32>("fletcher32/4096", data, size);
+  benchCrc<Adler32>("adler32/4096", data, size);
+}
+
+static void benchFraming() {
+  using Framer = CobsFramer<Crc8, 256>;
+  static Framer sender;
+  static Framer receiver;
+
+  const size_t size = 200;
+  for(size_t i = 0; i < size; i++) {
+    sender.writeBuffer()[i] = (char)(i * 3);
+  }
+  auto frame = sender.encodeFrame(size);
+
+  bench("readFrameByte/200", frame.length, [&]() {
+    for(size_t i = 0; i < frame.length; i++) {
+      doNotOptimize(receiver.readFrameByte(frame.data[i]));
+    }
+  });
+
+  // Line noise, which should be dropped without decoding
+  static char noise[200];
+  for(size_t i = 0; i < sizeof(noise) - 1; i++) {
+    noise[i] = (char)((i * 37 + 11) | 0x80);
+  }
+  noise[sizeof(noise) - 1] = 0;
+
+  bench("readFrameByte/noise", sizeof(noise), [&]() {
+    for(size_t i = 0; i < sizeof(noise); i++) {
+      doNotOptimize(receiver.readFrameByte(noise[i]));
+    }
+  });
+}
+
+static void benchRoundTrip() {
+  static Protocol sender(wireRead, wireWrite);
+  static Protocol receiver(wireRead, wireWrite);
+
+  Telemetry telemetry = { 1234, 1650000000000ull, Mode::Running, 12.5f, 0.75f, 215, "motor-1" };
+  sender.send(telemetry);
+  size_t telemetryLength = wireWritePos;
+  while(receiver.poll() == Protocol::Message::NoMessage) {}
+
+  bench("roundtrip/fixed", telemetryLength, [&]() {
+    sender.send(telemetry);
+    while(receiver.poll() == Protocol::Message::NoMessage) {}
+    Telemetry result;
+    doNotOptimize(receiver.decode(result));
+    doNotOptimize(result);
+  });
+
+  Path path;
+  path.id = 7;
+  for(int i = 0; i < 16; i++) {
+    path.waypoints[i] = { i * 10, i * -10, i };
+  }
+  sender.send(path);
+  size_t pathLength = wireWritePos;
+  while(receiver.poll() == Protocol::Message::NoMessage) {}
+
+  bench("roundtrip/nested", pathLength, [&]() {
+    sender.send(path);
+    while(receiver.poll() == Protocol::Message::NoMessage) {}
+    Path result;
+    doNotOptimize(receiver.decode(result));
+    doNotOptimize(result);
+  });
+}
+
+int main(int argc, char **argv) {
+  const char *jsonPath = nullptr;
+
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonPath = argv[++i];
+    }
+    else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    }
+    else if(strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+      minTime = atof(argv[++i]);
+    }
+    else {
+      fprintf(stderr, "Usage: %s [--json file] [--filter name] [--time seconds]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  benchStructs();
+  benchColumns();
+  benchCobs();
+  benchCrcs();
+  benchFraming();
+  benchRoundTrip();
+
+  if(jsonPath != nullptr) {
+    return writeJson(jsonPath);
+  }
+  return 0;
+}
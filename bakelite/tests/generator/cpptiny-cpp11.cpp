@@ -0,0 +1,27 @@
+/*
+ * The embedded runtime has to build as C++11, the Arduino AVR default.
+ * make test only compiles this, with and without hardware CRC32C.
+ */
+#include "bakelite.h"
+
+using namespace Bakelite;
+
+template <class C>
+static uint32_t crcOf(const char *data, size_t length) {
+  C crc;
+  crc.update(data, length);
+  crc.append(C::combine(crc.value(), crc.value(), length), length);
+  return (uint32_t)crc.value();
+}
+
+int main() {
+  const char data[] = "123456789";
+  CobsFramer<Crc8, 64> framer;
+  framer.readFrameByte(0);
+
+  return (int)(
+    crcOf<Crc8>(data, 9) + crcOf<Crc16>(data, 9) + crcOf<Crc16Ccitt>(data, 9) +
+    crcOf<Crc32>(data, 9) + crcOf<Crc32c>(data, 9) + crcOf<Fletcher16>(data, 9) +
+    crcOf<Fletcher32>(data, 9) + crcOf<Adler32>(data, 9)
+  );
+}
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <string>
+#include <vector>
 #include "struct.h"
 #include "doctest.h"
 #include "cpptiny.h"
@@ -143,14 +145,52 @@ TEST_CASE("cobs framer decode two null bytes") {
 
 TEST_CASE("cobs buffer overrun") {
   CobsFramer<CrcNoop, 2> framer;
-  auto result = framer.readFrameByte(0x05);
+  auto result = framer.readFrameByte(0x01);
   CHECK(result.status == CobsDecodeState::NotReady);
-  result = framer.readFrameByte(0x11);
+  result = framer.readFrameByte(0x01);
   CHECK(result.status == CobsDecodeState::NotReady);
-  result = framer.readFrameByte(0x22);
+  result = framer.readFrameByte(0x01);
   CHECK(result.status == CobsDecodeState::NotReady);
-  result = framer.readFrameByte(0x33);
+  result = framer.readFrameByte(0x01);
   CHECK(result.status == CobsDecodeState::BufferOverrun);
+
+  // The rest of the frame is discarded
+  CHECK(framer.readFrameByte(0x01).status == CobsDecodeState::NotReady);
+  CHECK(framer.readFrameByte(0x00).status == CobsDecodeState::NotReady);
+
+  result = writeFrame(framer, "\x02\x11\x00", 3);
+  CHECK(hexString((const char *)result.data, result.length) == "11");
+}
+
+TEST_CASE("cobs code past the buffer") {
+  // A code pointing past the end of the buffer fails straight away
+  CobsFramer<CrcNoop, 2> framer;
+  auto result = framer.readFrameByte(0x05);
+  CHECK(result.status == CobsDecodeState::DecodeFailure);
+  CHECK(framer.readFrameByte(0x11).status == CobsDecodeState::NotReady);
+  CHECK(framer.readFrameByte(0x00).status == CobsDecodeState::NotReady);
+
+  result = writeFrame(framer, "\x02\x11\x00", 3);
+  CHECK(hexString((const char *)result.data, result.length) == "11");
+}
+
+TEST_CASE("cobs frame filter") {
+  CobsFramer<Crc8, 256> framer;
+  framer.setFrameFilter([](uint8_t id, size_t length) {
+    return id == 1 && length == 3;
+  });
+
+  auto frame = framer.encodeFrame("\x01\x22\x33", 3);
+  string good((const char *)frame.data, frame.length);
+  frame = framer.encodeFrame("\x02\x22\x33", 3);
+  string wrongId((const char *)frame.data, frame.length);
+  frame = framer.encodeFrame("\x01\x22", 2);
+  string wrongLength((const char *)frame.data, frame.length);
+
+  writeFrame(framer, wrongId.data(), wrongId.size(), CobsDecodeState::Rejected);
+  writeFrame(framer, wrongLength.data(), wrongLength.size(), CobsDecodeState::Rejected);
+  auto result = writeFrame(framer, good.data(), good.size());
+  CHECK(hexString((const char *)result.data, result.length) == "012233");
 }
 
 TEST_CASE("cobs decode failure") {
@@ -202,6 +242,252 @@ TEST_CASE("cobs encode framer crc32") {
   CHECK(hexString((const char *)result.data, result.length) == "0911223344d19df27700");
 }
 
+template <typename C>
+uint32_t crcOf(const char *data, size_t length) {
+  C crc;
+  crc.update(data, length);
+  return crc.value();
+}
+
+TEST_CASE("crc catalog check values") {
+  CHECK(crcOf<Crc8>("123456789", 9) == 0xF4);
+  CHECK(crcOf<Crc16>("123456789", 9) == 0xBB3D);
+  CHECK(crcOf<Crc16Ccitt>("123456789", 9) == 0x29B1);
+  CHECK(crcOf<Crc32>("123456789", 9) == 0xCBF43926);
+  CHECK(crcOf<Crc32c>("123456789", 9) == 0xE3069283);
+}
+
+TEST_CASE("checksum check values") {
+  CHECK(crcOf<Fletcher16>("abcde", 5) == 0xC8F0);
+  CHECK(crcOf<Fletcher16>("abcdef", 6) == 0x2057);
+  CHECK(crcOf<Fletcher32>("abcde", 5) == 0xF04FC729);
+  CHECK(crcOf<Fletcher32>("abcdef", 6) == 0x56502D2A);
+  CHECK(crcOf<Adler32>("Wikipedia", 9) == 0x11E60398);
+}
+
+TEST_CASE("checksum large buffers") {
+  // Long enough to need several reductions, checked against a simple
+  // byte at a time version
+  static unsigned char data[20000];
+  for(size_t i = 0; i < sizeof(data); i++) {
+    data[i] = (unsigned char)(255 - i % 7);
+  }
+
+  uint32_t a = 1, b = 0, f1 = 0, f2 = 0;
+  for(size_t i = 0; i < sizeof(data); i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+    f1 = (f1 + data[i]) % 255;
+    f2 = (f2 + f1) % 255;
+  }
+  CHECK(crcOf<Adler32>((const char *)data, sizeof(data)) == ((b << 16) | a));
+  CHECK(crcOf<Fletcher16>((const char *)data, sizeof(data)) == ((f2 << 8) | f1));
+
+  Adler32 adler;
+  adler.update((const char *)data, 1001);
+  adler.update((const char *)data + 1001, sizeof(data) - 1001);
+  CHECK(adler.value() == ((b << 16) | a));
+
+  uint32_t w1 = 0, w2 = 0;
+  for(size_t i = 0; i < sizeof(data); i += 2) {
+    w1 = (w1 + (data[i] | (data[i + 1] << 8))) % 65535;
+    w2 = (w2 + w1) % 65535;
+  }
+  Fletcher32 fletcher;
+  fletcher.update((const char *)data, 1000);
+  fletcher.update((const char *)data + 1000, sizeof(data) - 1000);
+  CHECK(fletcher.value() == ((w2 << 16) | w1));
+
+  // The 16-bit sums used on AVR
+  uint16_t sum1 = 0, sum2 = 0;
+  fletcherSums<uint16_t, 255, 20>(data, sizeof(data), sum1, sum2);
+  CHECK(sum1 == f1);
+  CHECK(sum2 == f2);
+}
+
+template <typename C>
+void checkCombine(const char *data, size_t length) {
+  uint32_t whole = crcOf<C>(data, length);
+  for(size_t split = 0; split <= length; split += 2) {
+    auto first = crcOf<C>(data, split);
+    auto second = crcOf<C>(data + split, length - split);
+    CHECK(C::combine(first, second, length - split) == whole);
+    CHECK(C::removePrefix(first, whole, length - split) == second);
+
+    C crc;
+    crc.update(data, split);
+    crc.append(second, length - split);
+    CHECK(crc.value() == whole);
+  }
+}
+
+TEST_CASE("crc combine") {
+  const char data[] = "The quick brown fox jumps over the lazy dog";
+  size_t length = sizeof(data) - 1;
+  checkCombine<Crc8>(data, length);
+  checkCombine<Crc16>(data, length);
+  checkCombine<Crc16Ccitt>(data, length);
+  checkCombine<Crc32>(data, length);
+  checkCombine<Crc32c>(data, length);
+  checkCombine<Crc<crc32c_table_fn, uint32_t>>(data, length);
+  checkCombine<Fletcher16>(data, length);
+  checkCombine<Fletcher32>(data, length);
+  checkCombine<Adler32>(data, length);
+}
+
+TEST_CASE("parallel crc") {
+  static char data[1 << 20];
+  uint32_t seed = 7;
+  for(size_t i = 0; i < sizeof(data); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (char)(seed >> 16);
+  }
+
+  CHECK(parallelCrc<Crc32>(data, sizeof(data), 4) == crcOf<Crc32>(data, sizeof(data)));
+  CHECK(parallelCrc<Crc32c>(data, sizeof(data) - 3, 3) == crcOf<Crc32c>(data, sizeof(data) - 3));
+  CHECK(parallelCrc<Adler32>(data, sizeof(data), 5) == crcOf<Adler32>(data, sizeof(data)));
+  CHECK(parallelCrc<Crc16Ccitt>(data, 1000) == crcOf<Crc16Ccitt>(data, 1000));
+
+  // Fletcher-32 segments are rounded to whole words, 1048575 / 3 is odd
+  CHECK(parallelCrc<Fletcher32>(data, sizeof(data) - 1, 3) == crcOf<Fletcher32>(data, sizeof(data) - 1));
+  CHECK(parallelCrc<Fletcher16>(data, sizeof(data) - 1, 3) == crcOf<Fletcher16>(data, sizeof(data) - 1));
+}
+
+TEST_CASE("parallel stream decoding") {
+  // A partial frame, then frames of 1 to 120 bytes with every 50th
+  // corrupted, some idle delimiters, and an incomplete frame at the end
+  string stream("\x05\x11\x22\x00", 4);
+  CobsFramer<Crc8, 256> sender;
+  uint32_t seed = 11;
+  size_t corrupted = 0;
+  for(int i = 0; i < 2000; i++) {
+    size_t length = 1 + i % 120;
+    for(size_t j = 0; j < length; j++) {
+      seed = seed * 1103515245 + 12345;
+      sender.writeBuffer()[j] = (char)(seed >> 16);
+    }
+    auto frame = sender.encodeFrame(length);
+    string encoded((const char *)frame.data, frame.length);
+    if(i % 50 == 0) {
+      encoded[frame.length / 2] = encoded[frame.length / 2] == 0x55 ? 0x56 : 0x55;
+      corrupted++;
+    }
+    stream += encoded;
+    if(i % 300 == 0) {
+      stream += string(3, '\0');
+    }
+  }
+  size_t complete = stream.size();
+  stream += "\x03\x01";
+
+  // What a framer reading the stream byte by byte decodes
+  CobsFramer<Crc8, 256> receiver;
+  vector<string> expected;
+  for(char byte : stream) {
+    auto result = receiver.readFrameByte(byte);
+    if(result.status == CobsDecodeState::Decoded) {
+      expected.push_back(string(result.data, result.length));
+    }
+  }
+  REQUIRE(expected.size() == 2000 - corrupted);
+
+  auto check = [&](StreamDecoder<Crc8> &decoder) {
+    vector<string> decoded;
+    size_t failures = 0;
+    size_t lastOffset = 0;
+    size_t consumed = decoder.decode(stream.data(), stream.size(),
+      [](const StreamFrame &frame) {
+        return string(frame.data, frame.length);
+      },
+      [&](const StreamFrame &frame, string &result) {
+        CHECK(frame.offset >= lastOffset);
+        lastOffset = frame.offset;
+        CHECK(stream[frame.offset + frame.encodedLength - 1] == 0);
+        if(frame.status == CobsDecodeState::Decoded) {
+          decoded.push_back(result);
+        }
+        else {
+          failures++;
+        }
+      }
+    );
+    CHECK(consumed == complete);
+    CHECK(failures == corrupted + 1);
+    CHECK(decoded == expected);
+  };
+
+  // Small batches and slices, so frames cross slice and batch boundaries
+  StreamDecoder<Crc8> decoder(4, 1000, 97);
+  check(decoder);
+  StreamDecoder<Crc8> oneThread(1, 64, 64);
+  check(oneThread);
+  StreamDecoder<Crc8> defaults;
+  check(defaults);
+}
+
+TEST_CASE("fragment crc from frame crcs") {
+  CobsFramer<Crc32, 16> framer;
+  FragmentCrc<Crc32> messageCrc;
+  const char message[] = "A message split into three fragments";
+  size_t length = sizeof(message) - 1;
+  size_t chunk = framer.writeBufferSize() - fragmentHeaderSize;
+
+  for(size_t pos = 0; pos < length; pos += chunk) {
+    size_t count = length - pos < chunk ? length - pos : chunk;
+    char frame[16] = { 0, 1, 2, (char)(pos / chunk), 0 };
+    memcpy(frame + fragmentHeaderSize, message + pos, count);
+
+    auto encoded = framer.encodeFrame(frame, fragmentHeaderSize + count);
+    REQUIRE(encoded.status == 0);
+    auto decoded = writeFrame(framer, (const char *)encoded.data, encoded.length);
+    CHECK(decoded.crc == encoded.crc);
+    messageCrc.addFragment(decoded.data, decoded.length, decoded.crc);
+  }
+
+  CHECK(messageCrc.value() == crcOf<Crc32>(message, length));
+}
+
+TEST_CASE("crc chained updates") {
+  Crc32c crc;
+  crc.update("1234", 4);
+  crc.update("56789", 5);
+  CHECK(crc.value() == 0xE3069283);
+
+  Crc16Ccitt crc16;
+  crc16.update("12345", 5);
+  crc16.update("6789", 4);
+  CHECK(crc16.value() == 0x29B1);
+}
+
+TEST_CASE("crc32c large buffers") {
+  // Long enough to use both three way block sizes, with a tail
+  static char data[3 * 8192 + 3 * 256 + 13];
+  uint32_t seed = 1;
+  for(size_t i = 0; i < sizeof(data); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (char)(seed >> 16);
+  }
+
+  crc32c_fn fn;
+  crc32c_table_fn tableFn;
+  for(size_t length: { (size_t)0, (size_t)7, (size_t)769, (size_t)3 * 256, sizeof(data) }) {
+    CHECK(fn(data, length, 0) == tableFn(data, length, 0));
+  }
+
+  uint32_t chained = fn(data, 100, 0);
+  chained = fn(data + 100, sizeof(data) - 100, chained);
+  CHECK(chained == tableFn(data, sizeof(data), 0));
+}
+
+TEST_CASE("cobs encode framer crc32c") {
+  CobsFramer<Crc32c, 256> framer;
+  auto result = framer.encodeFrame("\x11\x22\x33\x44", 4);
+  CHECK(result.status == 0);
+  CHECK(result.length == 10);
+  auto decodeResult = writeFrame(framer, (const char *)result.data, result.length);
+  CHECK(hexString((const char *)decodeResult.data, decodeResult.length) == "11223344");
+}
+
 TEST_CASE("cobs decode crc8") {
   CobsFramer<Crc8, 256> framer;
   writeFrame(framer, "\x06\x11\x22\x33\x44\xf9\x00", 7);
@@ -1,9 +1,16 @@
 #include <iostream>
 #include <iomanip>
+#include <unistd.h>
 #include "cpptiny.h"
 #include "proto.h"
 #include "doctest.h"
 
+// Generated headers all declare ProtocolBase, so the fragmented protocol
+// gets its own namespace
+namespace Fragmented {
+#include "fragment.h"
+}
+
 using namespace std;
 using namespace Bakelite;
 
@@ -234,6 +241,324 @@ TEST_CASE("Proto recieve dynamic") {
   CHECK(result.numbers.data[2] == 456);
 }
 
+TEST_CASE("Proto send fragmented message") {
+  stream.reset();
+  // Frames hold at most 16 bytes, so the message is split into fragments
+  using SmallProtocol = Fragmented::ProtocolBase<CobsFramer<Crc8, 16>>;
+  SmallProtocol protocol(
+    []() { return stream.read(); },
+    [](const char *data, size_t length) { return stream.write(data, length); }
+  );
+
+  Fragmented::ArrayMessage msg;
+  int32_t numbers[20];
+  for(int i = 0; i < 20; i++) {
+    numbers[i] = i * 1000 - 5000;
+  }
+  msg.numbers.data = numbers;
+  msg.numbers.size = 20;
+  REQUIRE(protocol.send(msg) == 0);
+
+  // 81 bytes of message, 11 bytes in each of 7 full fragments plus 4 in the last
+  size_t length = stream.pos();
+  CHECK(length == 7 * 19 + 12);
+  CHECK(stream.hex().substr(0, 12) == "01020301010d");
+
+  char fragmentBuffer[128];
+  protocol.setFragmentBuffer(fragmentBuffer, sizeof(fragmentBuffer));
+  stream.seek(0);
+
+  for(;stream.pos() < length - 1;) {
+    CHECK(protocol.poll() == SmallProtocol::Message::NoMessage);
+  }
+  auto msgId = protocol.poll();
+  REQUIRE(msgId == SmallProtocol::Message::ArrayMessage);
+
+  Fragmented::ArrayMessage result;
+  char buffer[128];
+  CHECK(protocol.decode(result, buffer, sizeof(buffer)) == 0);
+  REQUIRE(result.numbers.size == 20);
+  for(int i = 0; i < 20; i++) {
+    CHECK(result.numbers.data[i] == numbers[i]);
+  }
+}
+
+unsigned long fakeClock = 0;
+
+TEST_CASE("Fragment reassembly") {
+  char buffer[8];
+  FragmentAssembler assembler;
+  assembler.setBuffer(buffer, sizeof(buffer));
+  assembler.setTimeout([]() { return fakeClock; }, 100);
+
+  // message 3, transfer 7
+  const char first[] = { 3, 7, 0x00, 0x00, 'a', 'b' };
+  const char second[] = { 3, 7, 0x01, 0x00, 'c' };
+  const char last[] = { 3, 7, 0x02, (char)0x80, 'd', 'e' };
+
+  CHECK(assembler.addFragment(first, sizeof(first)).status == FragmentStatus::Incomplete);
+  CHECK(assembler.addFragment(second, sizeof(second)).status == FragmentStatus::Incomplete);
+  auto result = assembler.addFragment(last, sizeof(last));
+  REQUIRE(result.status == FragmentStatus::Complete);
+  CHECK(result.messageId == 3);
+  CHECK(string(result.data, result.length) == "abcde");
+
+  // A lost fragment drops the message
+  CHECK(assembler.addFragment(first, sizeof(first)).status == FragmentStatus::Incomplete);
+  CHECK(assembler.addFragment(last, sizeof(last)).status == FragmentStatus::Dropped);
+  CHECK(assembler.addFragment(second, sizeof(second)).status == FragmentStatus::Dropped);
+
+  // So does a timeout
+  fakeClock = 1000;
+  CHECK(assembler.addFragment(first, sizeof(first)).status == FragmentStatus::Incomplete);
+  fakeClock = 1050;
+  CHECK(assembler.checkTimeout() == false);
+  fakeClock = 1101;
+  CHECK(assembler.checkTimeout() == true);
+  CHECK(assembler.addFragment(second, sizeof(second)).status == FragmentStatus::Dropped);
+
+  // And a message too large for the buffer
+  const char large[] = { 3, 8, 0x00, (char)0x80, '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  CHECK(assembler.addFragment(large, sizeof(large)).status == FragmentStatus::Dropped);
+}
+
+TEST_CASE("Proto link stats") {
+  stream.reset();
+  using StatsProtocol = ProtocolWithStats<LinkStats<>>;
+  StatsProtocol protocol(
+    []() { return stream.read(); },
+    [](const char *data, size_t length) { return stream.write(data, length); }
+  );
+
+  // A good frame, one with a bad CRC, and another good one
+  Ack ack = {0x22};
+  REQUIRE(protocol.send(ack) == 0);
+  const char corrupt[] = { 0x04, 0x02, 0x23, (char)0xc4, 0x00 };
+  stream.write(corrupt, sizeof(corrupt));
+  REQUIRE(protocol.send(ack) == 0);
+
+  size_t length = stream.pos();
+  stream.seek(0);
+  int received = 0;
+  while(stream.pos() < length) {
+    if(protocol.poll() == StatsProtocol::Message::Ack) {
+      received++;
+    }
+  }
+  CHECK(received == 2);
+
+  auto stats = protocol.stats().snapshot();
+  CHECK(stats.bytesOut == 10);
+  CHECK(stats.framesSent == 2);
+  CHECK(stats.maxFrameOut == 5);
+  CHECK(stats.messagesOut[2] == 2);
+  CHECK(stats.messageBytesOut[2] == 2);
+
+  CHECK(stats.bytesIn == 15);
+  CHECK(stats.framesDecoded == 2);
+  CHECK(stats.crcFailures == 1);
+  CHECK(stats.decodeFailures == 0);
+  CHECK(stats.overruns == 0);
+  CHECK(stats.resyncs == 1);
+  CHECK(stats.maxFrameIn == 5);
+  CHECK(stats.messagesIn[2] == 2);
+  CHECK(stats.messageBytesIn[2] == 2);
+
+  protocol.stats().reset();
+  CHECK(protocol.stats().snapshot().bytesIn == 0);
+}
+
+TEST_CASE("Proto rejects impossible frames") {
+  stream.reset();
+  using StatsProtocol = ProtocolWithStats<LinkStats<>>;
+  StatsProtocol protocol(
+    []() { return stream.read(); },
+    [](const char *data, size_t length) { return stream.write(data, length); }
+  );
+
+  // Frames with good CRCs, but an unknown message ID, and an Ack with no data
+  CobsFramer<Crc8, 16> framer;
+  auto frame = framer.encodeFrame("\x09\x22", 2);
+  stream.write((const char *)frame.data, frame.length);
+  frame = framer.encodeFrame("\x02", 1);
+  stream.write((const char *)frame.data, frame.length);
+
+  Ack ack = {0x22};
+  REQUIRE(protocol.send(ack) == 0);
+
+  size_t length = stream.pos();
+  stream.seek(0);
+  int received = 0;
+  while(stream.pos() < length) {
+    if(protocol.poll() != StatsProtocol::Message::NoMessage) {
+      received++;
+    }
+  }
+  CHECK(received == 1);
+
+  auto stats = protocol.stats().snapshot();
+  CHECK(stats.rejected == 2);
+  CHECK(stats.framesDecoded == 1);
+}
+
+TEST_CASE("Proto latency stats") {
+  stream.reset();
+  using Stats = StatsPair<LinkStats<>, LatencyStats<>>;
+  using StatsProtocol = ProtocolWithStats<Stats>;
+  StatsProtocol protocol(
+    []() { return stream.read(); },
+    [](const char *data, size_t length) { return stream.write(data, length); }
+  );
+
+  // Every reading is one tick after the last
+  fakeClock = 0;
+  protocol.stats().second().setClock([]() { return fakeClock++; });
+
+  Ack ack = {0x22};
+  REQUIRE(protocol.send(ack) == 0);
+
+  size_t length = stream.pos();
+  stream.seek(0);
+  while(stream.pos() < length) {
+    protocol.poll();
+  }
+  CHECK(protocol.stats().first().snapshot().framesDecoded == 1);
+
+  auto &latency = protocol.stats().second();
+  const LatencyStage stages[] = {
+    LatencyStage::Receive, LatencyStage::Decode, LatencyStage::Crc,
+    LatencyStage::Dispatch, LatencyStage::Pack, LatencyStage::Write
+  };
+  for(auto stage : stages) {
+    auto &histogram = latency.histogram(2, stage);
+    CHECK(histogram.counts[0] == 0);
+    CHECK(histogram.counts[1] == 1);
+    CHECK(histogram.max == 1);
+  }
+  CHECK(latency.histogram(1, LatencyStage::Receive).counts[1] == 0);
+}
+
+TEST_CASE("Capture files") {
+  string path = "/tmp/bakelite-capture-" + to_string(getpid()) + ".bkc";
+  string indexPath = path + ".idx";
+
+  // Decoded frames, as the framer returns them, at t = 0, 10, 20...
+  CaptureWriter writer;
+  REQUIRE(writer.open(path.c_str()) == 0);
+  for(int i = 0; i < 10; i++) {
+    char frame[64];
+    BufferStream out(frame + 1, sizeof(frame) - 1);
+    if(i % 3 == 0) {
+      frame[0] = (char)Protocol::Message::TestMessage;
+      TestMessage msg = { (uint8_t)i, i * -1000, true, "capture" };
+      REQUIRE(msg.pack(out) == 0);
+    }
+    else {
+      frame[0] = (char)Protocol::Message::Ack;
+      Ack ack = { (uint8_t)i };
+      REQUIRE(ack.pack(out) == 0);
+    }
+    REQUIRE(writer.write(i * 10, frame, out.pos() + 1, i == 9 ? captureSent : 0) == 0);
+  }
+
+  // And one raw frame from the wire
+  CobsFramer<Crc8, 16> framer;
+  auto raw = framer.encodeFrame("\x02\x2a", 2);
+  REQUIRE(writer.write(100, (const char *)raw.data, raw.length, captureRaw) == 0);
+  writer.close();
+
+  auto check = [&](const CaptureReader &reader) {
+    REQUIRE(reader.size() == 11);
+    CHECK(reader.seekTime(0) == 0);
+    CHECK(reader.seekTime(25) == 3);
+    CHECK(reader.seekTime(1000) == 11);
+    CHECK(reader.seekId(1) == 0);
+    CHECK(reader.seekId(1, 1) == 3);
+    CHECK(reader.seekId(1, 10) == 11);
+    CHECK(reader[9].flags == captureSent);
+
+    auto frame = reader[reader.seekTime(60)];
+    CHECK(frame.timestamp == 60);
+    CHECK(frame.id == 1);
+    char heap[32];
+    TestMessage msg;
+    auto in = frame.stream(heap, sizeof(heap));
+    REQUIRE(msg.unpack(in) == 0);
+    CHECK(msg.a == 6);
+    CHECK(msg.b == -6000);
+    CHECK(string(msg.message) == "capture");
+
+    size_t acks = 0;
+    for(auto f : reader) {
+      if(f.id == 2 && !(f.flags & captureRaw)) {
+        Ack ack;
+        auto ackStream = f.stream();
+        REQUIRE(ack.unpack(ackStream) == 0);
+        CHECK(ack.code == f.timestamp / 10);
+        acks++;
+      }
+    }
+    CHECK(acks == 6);
+
+    auto last = reader[10];
+    CHECK(last.flags == captureRaw);
+    CHECK(last.id == 2);
+    CHECK(last.length == raw.length);
+    CHECK(memcmp(last.data, raw.data, raw.length) == 0);
+  };
+
+  CaptureReader reader;
+  REQUIRE(reader.open(path.c_str()) == 0);
+  CHECK(!reader.indexRebuilt());
+  check(reader);
+  reader.close();
+
+  // An index entry pointing outside the capture, with a valid last
+  // entry, is rebuilt rather than trusted
+  FILE *index = fopen(indexPath.c_str(), "r+b");
+  REQUIRE(index != nullptr);
+  CaptureIndexEntry entry;
+  long entryPos = (long)(sizeof(CaptureHeader) + 3 * sizeof(CaptureIndexEntry));
+  fseek(index, entryPos, SEEK_SET);
+  REQUIRE(fread(&entry, sizeof(entry), 1, index) == 1);
+  entry.offset = (uint64_t)1 << 40;
+  fseek(index, entryPos, SEEK_SET);
+  fwrite(&entry, sizeof(entry), 1, index);
+  fclose(index);
+  REQUIRE(reader.open(path.c_str()) == 0);
+  CHECK(reader.indexRebuilt());
+  check(reader);
+  reader.close();
+
+  // Without the index, it's rebuilt from the capture
+  remove(indexPath.c_str());
+  REQUIRE(reader.open(path.c_str()) == 0);
+  CHECK(reader.indexRebuilt());
+  check(reader);
+  reader.close();
+
+  // A partly written frame at the end is ignored
+  FILE *file = fopen(path.c_str(), "ab");
+  REQUIRE(file != nullptr);
+  CaptureRecord partial = { 200, 40, 1, 0, 0 };
+  fwrite(&partial, sizeof(partial), 1, file);
+  fwrite("abc", 1, 3, file);
+  fclose(file);
+  REQUIRE(reader.open(path.c_str()) == 0);
+  check(reader);
+  reader.close();
+
+  // Not a capture
+  CHECK(reader.open(indexPath.c_str()) == -1);
+  file = fopen(indexPath.c_str(), "wb");
+  fputs("not a capture file", file);
+  fclose(file);
+  CHECK(reader.open(indexPath.c_str()) == -2);
+
+  remove(path.c_str());
+  remove(indexPath.c_str());
+}
+
 // Convenience test for checking memory overhead
 // TEST_CASE("Proto check size") {
 //   stream.reset();
@@ -233,3 +233,482 @@ TEST_CASE("struct with variable types") {
   CHECK(string(t2.e.data[1]) == "def");
   CHECK(string(t2.e.data[2]) == "ghi");
 }
+
+TEST_CASE("struct with delta encoded arrays") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+  int32_t wave[5] = { 100000, 100010, 100005, 99990, 100020 };
+
+  DeltaStruct t1 = {
+    { 1000, 1002, 999, 1005, 1010, 1000, 990, 995, 1001, 1003 },
+    { wave, 5 },
+    300,
+    -3
+  };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 31);
+  CHECK(hexString(data, stream.pos()) == "e8030200fdff06000500f6fff6ff05000600020005c09a0c14091d3cac0205");
+
+  DeltaStruct t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+
+  CHECK(vector<int16_t>(t2.samples, t2.samples + 10) == vector<int16_t>({ 1000, 1002, 999, 1005, 1010, 1000, 990, 995, 1001, 1003 }));
+  CHECK(t2.wave.size == 5);
+  CHECK(vector<int32_t>(t2.wave.data, t2.wave.data + t2.wave.size) == vector<int32_t>(wave, wave + 5));
+  CHECK(t2.count == 300);
+  CHECK(t2.offset == -3);
+}
+
+TEST_CASE("struct with bitfields") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+
+  WritePort t1 = {
+    7,
+    true, false, true, true, -3,
+    { true, ConversionRate::Rate_110, 3, false, true, false, -200 }
+  };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 5);
+  CHECK(hexString(data, stream.pos()) == "07dd5d009c");
+
+  WritePort t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+
+  CHECK(t2.portNum == 7);
+  CHECK(t2.pin1 == true);
+  CHECK(t2.pin2 == false);
+  CHECK(t2.pin3 == true);
+  CHECK(t2.pin4 == true);
+  CHECK(t2.level == -3);
+  CHECK(t2.control.oneShot == true);
+  CHECK(t2.control.conversionRate == ConversionRate::Rate_110);
+  CHECK(t2.control.conversionFaults == 3);
+  CHECK(t2.control.outputPriority == false);
+  CHECK(t2.control.alertFunction == true);
+  CHECK(t2.control.shutdownMode == false);
+  CHECK(t2.control.offset == -200);
+}
+
+TEST_CASE("union") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+
+  Command t1;
+  CHECK(t1.kind == Command::Kind::None);
+  t1.setMove() = { -2, 300 };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 5);
+  CHECK(hexString(data, stream.pos()) == "01feff2c01");
+
+  Command t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+  CHECK(t2.kind == Command::Kind::move);
+  CHECK(t2.value.move.x == -2);
+  CHECK(t2.value.move.y == 300);
+
+  stream.seek(0);
+  t1.setSteps() = -150;
+  REQUIRE(t1.pack(stream) == 0);
+  CHECK(hexString(data, stream.pos()) == "03ab02");
+
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+  CHECK(t2.kind == Command::Kind::steps);
+  CHECK(t2.value.steps == -150);
+
+  struct {
+    int operator()(const Move &m) { return m.x + m.y; }
+    int operator()(uint8_t speed) { return speed; }
+    int operator()(int32_t steps) { return steps; }
+    int operator()(const char *label) { return -1; }
+  } visitor;
+  CHECK(t2.visit(visitor) == -150);
+
+  stream.seek(0);
+  t1.setMove() = { -2, 300 };
+  t1.pack(stream);
+  stream.seek(0);
+  t2.unpack(stream);
+  CHECK(t2.visit(visitor) == 298);
+
+  Command empty;
+  CHECK(empty.visit(visitor) == 0);
+
+  data[0] = 5;
+  stream.seek(0);
+  CHECK(t2.unpack(stream) == -8);
+}
+
+TEST_CASE("float16") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+  float values[10] = { 1.0f, 0.1f, 65504.0f, 1e-7f, 1e5f, 0.5f, -0.0f, 3.140625f, 2.0f, 1024.0f };
+
+  HalfStruct t1 = { -2.5f, { values, 10 } };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 23);
+  CHECK(hexString(data, stream.pos()) == "00c10a003c662eff7b0200007c00380080484200400064");
+
+  HalfStruct t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+
+  CHECK(t2.a == -2.5f);
+  REQUIRE(t2.b.size == 10);
+  CHECK(t2.b.data[0] == 1.0f);
+  CHECK(t2.b.data[1] == doctest::Approx(0.1f).epsilon(0.001));
+  CHECK(t2.b.data[2] == 65504.0f);
+  CHECK(t2.b.data[3] == doctest::Approx(1.1920929e-7f));
+  CHECK(t2.b.data[4] == INFINITY);
+  CHECK(t2.b.data[5] == 0.5f);
+  CHECK(t2.b.data[6] == 0.0f);
+  CHECK(t2.b.data[9] == 1024.0f);
+
+  CHECK(halfToFloat(floatToHalf(NAN)) != halfToFloat(floatToHalf(NAN)));
+  CHECK(floatToHalf(-1e-9f) == 0x8000);
+}
+
+TEST_CASE("scaled floats") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+  float clamped[4] = { 4000.0f, -4000.0f, NAN, 0.26f };
+
+  ScaledStruct t1 = {
+    21.37f,
+    12.5f,
+    { 1.5, -0.0007, 2000000.0 },
+    { clamped, 4 }
+  };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 24);
+  CHECK(hexString(data, stream.pos()) == "590869dc050000ffffffff0094357704ff7f008000000300");
+
+  ScaledStruct t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+
+  CHECK(t2.temperature == doctest::Approx(21.37f));
+  CHECK(t2.humidity == 12.5f);
+  CHECK(t2.samples[0] == doctest::Approx(1.5));
+  CHECK(t2.samples[1] == doctest::Approx(-0.001));
+  CHECK(t2.samples[2] == doctest::Approx(2000000.0));
+  REQUIRE(t2.clamped.size == 4);
+  CHECK(t2.clamped.data[0] == doctest::Approx(3276.7f));
+  CHECK(t2.clamped.data[1] == doctest::Approx(-3276.8f));
+  CHECK(t2.clamped.data[2] == 0.0f);
+  CHECK(t2.clamped.data[3] == doctest::Approx(0.3f));
+
+  CHECK(quantize<int32_t>(1e30f, 1.0f, 0.0f) == 2147483647);
+  CHECK(quantize<int32_t>(-1e30f, 1.0f, 0.0f) == -2147483647 - 1);
+  CHECK(quantize<uint8_t>(-3.0f, 1.0f, 0.0f) == 0);
+}
+
+TEST_CASE("byte swapping") {
+  CHECK(byteSwap((uint16_t)0x1234) == 0x3412);
+  CHECK(byteSwap((uint32_t)0x12345678) == 0x78563412);
+  CHECK(byteSwap((uint64_t)0x0102030405060708ull) == 0x0807060504030201ull);
+  CHECK(byteSwap((int16_t)-2) == (int16_t)0xfeff);
+  CHECK(byteSwap(byteSwap(3.25f)) == 3.25f);
+  CHECK(byteSwap(byteSwap(-1e100)) == -1e100);
+
+  // The wire format is little endian, whatever the host
+  char data[8];
+  BufferStream stream(data, 8);
+  write(stream, (uint32_t)0x12345678);
+  CHECK(hexString(data, 4) == "78563412");
+}
+
+TEST_CASE("primitive arrays") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+  float floats[2] = { 1.0f, -2.0f };
+
+  PrimitiveArrays t1 = { { 1, -2, 0x12345678 }, { floats, 2 } };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 21);
+  CHECK(hexString(data, stream.pos()) == "01000000feffffff78563412020000803f000000c0");
+
+  PrimitiveArrays t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+
+  CHECK(t2.a[0] == 1);
+  CHECK(t2.a[1] == -2);
+  CHECK(t2.a[2] == 0x12345678);
+  REQUIRE(t2.b.size == 2);
+  CHECK(t2.b.data[0] == 1.0f);
+  CHECK(t2.b.data[1] == -2.0f);
+
+  // The whole array is bounds checked up front
+  BufferStream small(data, 8);
+  CHECK(t2.unpack(small) == -2);
+}
+
+TEST_CASE("variable length strings") {
+  char *data = new char[256];
+  char *heap = new char[256];
+  BufferStream stream(data, 256, heap, 256);
+  const char *tags[2] = { "a", "bc" };
+
+  LogEvent t1 = { (char *)"hello", (char *)"end", { (char **)tags, 2 } };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(stream.pos() == 16);
+  CHECK(hexString(data, stream.pos()) == "0568656c6c6f656e6400020161026263");
+
+  LogEvent t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+
+  CHECK(string(t2.message) == "hello");
+  CHECK(string(t2.tail) == "end");
+  REQUIRE(t2.tags.size == 2);
+  CHECK(string(t2.tags.data[0]) == "a");
+  CHECK(string(t2.tags.data[1]) == "bc");
+
+  // A string without a terminator fails, without reading past the end
+  BufferStream truncated(data, 9, heap, 256);
+  CHECK(t2.unpack(truncated) == -2);
+
+  // Not enough heap for the string
+  BufferStream noHeap(data, 256, heap, 8);
+  CHECK(t2.unpack(noHeap) == -6);
+}
+
+TEST_CASE("wider size prefixes") {
+  char *data = new char[4096];
+  char *heap = new char[4096];
+  BufferStream stream(data, 4096, heap, 4096);
+  char bytes[3] = { (char)0xaa, (char)0xbb, (char)0xcc };
+  uint16_t values[3] = { 1, 2, 3 };
+  char chunkA[1] = { 0x11 };
+  char chunkB[1] = { 0x22 };
+  SizedArray<char, uint16_t> chunks[2] = { { chunkA, 1 }, { chunkB, 1 } };
+
+  LargeSizes t1 = { { bytes, 3 }, { values, 3 }, (char *)"hi", { chunks, 2 } };
+  REQUIRE(t1.pack(stream) == 0);
+
+  CHECK(hexString(data, stream.pos()) == "0300aabbcc030100020003000200000068690200010011010022");
+
+  LargeSizes t2;
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+  CHECK(t2.data.size == 3);
+  CHECK(t2.values.size == 3);
+  CHECK(t2.values.data[2] == 3);
+  CHECK(string(t2.name) == "hi");
+  REQUIRE(t2.chunks.size == 2);
+  CHECK(t2.chunks.data[1].data[0] == 0x22);
+
+  char blob[1000];
+  for(int i = 0; i < 1000; i++) {
+    blob[i] = (char)i;
+  }
+  t1.data = { blob, 1000 };
+  stream.seek(0);
+  REQUIRE(t1.pack(stream) == 0);
+  CHECK(hexString(data, 2) == "e803");
+
+  stream.seek(0);
+  REQUIRE(t2.unpack(stream) == 0);
+  REQUIRE(t2.data.size == 1000);
+  CHECK(memcmp(t2.data.data, blob, 1000) == 0);
+}
+
+TEST_CASE("oversized prefixes") {
+  char data[8] = { (char)0xff, (char)0xff, (char)0xff, (char)0xff, 1, 2, 3, 4 };
+  char heap[64];
+
+  // A string prefix longer than the stream is rejected before allocating
+  char *str = nullptr;
+  BufferStream stream(data, sizeof(data), heap, sizeof(heap));
+  CHECK(readPrefixedString<uint32_t>(stream, str) == -2);
+
+  BufferStream varint(data, sizeof(data), heap, sizeof(heap));
+  CHECK(readPrefixedString<VarintSize>(varint, str) == -2);
+
+  // An array count whose size in bytes wraps doesn't fit the heap
+  SizedArray<uint32_t, uint32_t> values;
+  BufferStream arrays(data, sizeof(data), heap, sizeof(heap));
+  CHECK(readPrimitiveArray(arrays, values) == -4);
+
+  BufferStream allocs(data, sizeof(data), heap, sizeof(heap));
+  CHECK(allocs.allocArray((size_t)-1 / 4 + 2, 4) == nullptr);
+  CHECK(allocs.alloc((size_t)-1) == nullptr);
+  CHECK(allocs.alloc(sizeof(heap)) == heap);
+  CHECK(allocs.alloc(1) == nullptr);
+}
+
+TEST_CASE("columnar unpack") {
+  const size_t count = 5;
+  char packed[count][TestStruct::maxPackedSize()];
+  const char *messages[count];
+  size_t lengths[count];
+  for(size_t i = 0; i < count; i++) {
+    TestStruct t = {
+      (int8_t)(i - 2), (int32_t)(i * 100000), (uint8_t)i, (uint16_t)(i * 1000), i * 1.5f,
+      i % 2 == 0, true, false, { (char)i, 1, 2, 3 }, "abc"
+    };
+    t.str[0] = (char)('a' + i);
+    BufferStream stream(packed[i], sizeof(packed[i]));
+    REQUIRE(t.pack(stream) == 0);
+    messages[i] = packed[i];
+    lengths[i] = sizeof(packed[i]);
+  }
+
+  int8_t int1[count];
+  int32_t int2[count];
+  uint16_t uint2[count];
+  float float1[count];
+  bool b1[count];
+  char data[count][4];
+  char str[count][5];
+  TestStruct::Columns columns;
+  columns.int1 = int1;
+  columns.int2 = int2;
+  columns.uint2 = uint2;
+  columns.float1 = float1;
+  columns.b1 = b1;
+  columns.data = data;
+  columns.str = str;
+  REQUIRE(TestStruct::unpackColumns(columns, messages, lengths, count) == 0);
+
+  for(size_t i = 0; i < count; i++) {
+    TestStruct t;
+    BufferStream stream(packed[i], sizeof(packed[i]));
+    REQUIRE(t.unpack(stream) == 0);
+    CHECK(int1[i] == t.int1);
+    CHECK(int2[i] == t.int2);
+    CHECK(uint2[i] == t.uint2);
+    CHECK(float1[i] == t.float1);
+    CHECK(b1[i] == t.b1);
+    CHECK(memcmp(data[i], t.data, sizeof(t.data)) == 0);
+    CHECK(string(str[i]) == string(t.str));
+  }
+
+  // Members in bitfields and nested structs are unpacked
+  char portData[2][WritePort::maxPackedSize()];
+  const char *ports[2] = { portData[0], portData[1] };
+  size_t portLengths[2] = { sizeof(portData[0]), sizeof(portData[1]) };
+  for(size_t i = 0; i < 2; i++) {
+    WritePort t = {
+      (uint8_t)(i + 7),
+      i == 0, false, true, true, (int8_t)(i - 3),
+      { true, ConversionRate::Rate_110, 3, false, true, false, (int16_t)(i * 100 - 200) }
+    };
+    BufferStream stream(portData[i], sizeof(portData[i]));
+    REQUIRE(t.pack(stream) == 0);
+  }
+
+  uint8_t portNum[2];
+  bool pin1[2];
+  int8_t level[2];
+  ControlRegister control[2];
+  WritePort::Columns portColumns;
+  portColumns.portNum = portNum;
+  portColumns.pin1 = pin1;
+  portColumns.level = level;
+  portColumns.control = control;
+  REQUIRE(WritePort::unpackColumns(portColumns, ports, portLengths, 2) == 0);
+
+  CHECK(portNum[0] == 7);
+  CHECK(portNum[1] == 8);
+  CHECK(pin1[0] == true);
+  CHECK(pin1[1] == false);
+  CHECK(level[0] == -3);
+  CHECK(level[1] == -2);
+  CHECK(control[0].conversionRate == ConversionRate::Rate_110);
+  CHECK(control[0].offset == -200);
+  CHECK(control[1].offset == -100);
+
+  // Every message must be complete
+  portLengths[1]--;
+  CHECK(WritePort::unpackColumns(portColumns, ports, portLengths, 2) == -2);
+
+  // 4 and 8 byte members, which are gathered 4 rows at a time with AVX2,
+  // followed by a partial group
+  const size_t rows = 11;
+  char readingData[rows][Reading::maxPackedSize()];
+  const char *readings[rows];
+  size_t readingLengths[rows];
+  for(size_t i = 0; i < rows; i++) {
+    Reading t = { 1650000000000ull + i * 7919, (uint8_t)i, i * -0.125, (uint32_t)(i * 100003) };
+    BufferStream stream(readingData[rows - 1 - i], sizeof(readingData[0]));
+    REQUIRE(t.pack(stream) == 0);
+    // Messages don't have to be in order in memory
+    readings[i] = readingData[rows - 1 - i];
+    readingLengths[i] = sizeof(readingData[0]);
+  }
+
+  uint64_t time[rows];
+  uint8_t channel[rows];
+  double value[rows];
+  uint32_t readingCount[rows];
+  Reading::Columns readingColumns;
+  readingColumns.time = time;
+  readingColumns.channel = channel;
+  readingColumns.value = value;
+  readingColumns.count = readingCount;
+  REQUIRE(Reading::unpackColumns(readingColumns, readings, readingLengths, rows) == 0);
+
+  for(size_t i = 0; i < rows; i++) {
+    CHECK(time[i] == 1650000000000ull + i * 7919);
+    CHECK(channel[i] == i);
+    CHECK(value[i] == i * -0.125);
+    CHECK(readingCount[i] == i * 100003);
+  }
+}
+
+TEST_CASE("max sizes") {
+  static_assert(Ack::maxPackedSize() == 1, "Ack size");
+  static_assert(TestStruct::maxPackedSize() == 24, "TestStruct size");
+  static_assert(ArrayStruct::maxPackedSize() == 17, "ArrayStruct size");
+  static_assert(TestStruct::maxHeapSize() == 0, "TestStruct heap");
+  static_assert(TestStruct::minPackedSize() == 24, "TestStruct min size");
+  static_assert(VariableLength::minPackedSize() == 5, "VariableLength min size");
+  static_assert(LargeSizes::minPackedSize() == 9, "LargeSizes min size");
+
+  // Null terminated strings have no upper bound
+  CHECK(VariableLength::maxPackedSize() == unboundedSize);
+  CHECK(LogEvent::maxHeapSize() == unboundedSize);
+  CHECK(LargeSizes::maxHeapSize() == unboundedSize);
+
+  CHECK(PrimitiveArrays::maxPackedSize() == 12 + 1 + 255 * 4);
+  CHECK(PrimitiveArrays::maxHeapSize() == 255 * 4);
+
+  const size_t size = PrimitiveArrays::maxPackedSize();
+  const size_t heapSize = PrimitiveArrays::maxHeapSize();
+  char *data = new char[size];
+  char *heap = new char[heapSize];
+  float floats[255] = { 0 };
+
+  // The largest possible struct fits exactly
+  PrimitiveArrays t1 = { { 1, 2, 3 }, { floats, 255 } };
+  BufferStream stream(data, size);
+  REQUIRE(t1.pack(stream) == 0);
+  CHECK(stream.pos() == size);
+
+  PrimitiveArrays t2;
+  BufferStream exact(data, size, heap, heapSize);
+  CHECK(t2.unpack(exact) == 0);
+  CHECK(t2.b.size == 255);
+
+  BufferStream tooSmall(data, size, heap, heapSize - 1);
+  CHECK(t2.unpack(tooSmall) == -4);
+}
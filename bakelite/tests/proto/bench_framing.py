@@ -0,0 +1,53 @@
+"""Benchmarks for the Python runtime's framing and CRCs.
+
+Compares the native extension, when it's built, with pure Python:
+
+  $ poetry run python -m bakelite.tests.proto.bench_framing
+"""
+import random
+import timeit
+from typing import Callable
+
+from bakelite.proto import crc, framing
+from bakelite.proto.crc import CrcSize
+
+
+def _bench(name: str, fn: Callable[[], object], size: int) -> None:
+  count, elapsed = timeit.Timer(fn).autorange()
+  per_op = elapsed / count
+  print(f"{name:<36} {per_op * 1e6:10.2f} us/op {size / per_op / 1e6:10.2f} MB/s")
+
+
+def main() -> None:
+  rand = random.Random(42)
+  data = bytes(rand.randrange(256) for _ in range(256))
+  encoded = framing.encode_python(data)
+
+  print(f"native extension: {'yes' if framing._native is not None else 'no'}")
+
+  _bench("encode/256 python", lambda: framing.encode_python(data), len(data))
+  _bench("encode/256", lambda: framing.encode(data), len(data))
+  _bench("decode/256 python", lambda: framing.decode_python(encoded), len(data))
+  _bench("decode/256", lambda: framing.decode(encoded), len(data))
+
+  for size in (CrcSize.CRC8, CrcSize.CRC32, CrcSize.CRC32C, CrcSize.FLETCHER16):
+    python_fn = crc.python_crc_funcs[size]
+    fn = crc.crc_funcs[size]
+    _bench(f"{size.value}/256 python", lambda: python_fn(data), len(data))
+    _bench(f"{size.value}/256", lambda: fn(data), len(data))
+
+  # Frames per second through the framer, 64 frames at a time
+  framer = framing.Framer(crc=CrcSize.CRC8)
+  frame = framer.encode_frame(data[:64])
+  stream = frame * 64
+
+  def decode_frames() -> None:
+    framer.append_buffer(stream)
+    while framer.decode_frame() is not None:
+      pass
+
+  _bench("Framer.decode_frame 64 x 64 bytes", decode_frames, len(stream))
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,89 @@
+"""Benchmarks for the Python runtime's struct serialization.
+
+Compares precompiled struct layouts with packing member by member:
+
+  $ poetry run python -m bakelite.tests.proto.bench_serialization
+"""
+import os
+import timeit
+from io import BytesIO
+from typing import Any, Callable
+
+from bakelite.generator import parse
+from bakelite.generator.python import render
+from bakelite.generator.types import bitfield_groups
+from bakelite.proto.serialization import (
+    _pack_bitfield,
+    _pack_field,
+    _unpack_bitfield,
+    _unpack_field,
+)
+
+FILE_DIR = os.path.dirname(os.path.realpath(__file__))
+
+
+def _bench(name: str, fn: Callable[[], object]) -> None:
+  count, elapsed = timeit.Timer(fn).autorange()
+  per_op = elapsed / count
+  print(f"{name:<36} {per_op * 1e6:10.2f} us/op {1 / per_op:12.0f} ops/s")
+
+
+def _pack_members(value: Any) -> bytes:
+  stream = BytesIO()
+  for member in bitfield_groups(value._desc):
+    if isinstance(member, list):
+      _pack_bitfield(stream, value, member, value._registry)
+    else:
+      _pack_field(stream, getattr(value, member.name), member, value._registry)
+  return stream.getvalue()
+
+
+def _unpack_members(cls: Any, data: bytes) -> Any:
+  stream = BytesIO(data)
+  members = {}
+  for member in bitfield_groups(cls._desc):
+    if isinstance(member, list):
+      members.update(_unpack_bitfield(stream, member, cls._registry))
+    else:
+      members[member.name] = _unpack_field(stream, member, cls._registry)
+  return cls(**members)
+
+
+def _bench_struct(name: str, value: Any) -> None:
+  cls = type(value)
+
+  def pack() -> bytes:
+    stream = BytesIO()
+    value.pack(stream)
+    return stream.getvalue()
+
+  data = pack()
+  assert _pack_members(value) == data
+
+  _bench(f"pack/{name} members", lambda: _pack_members(value))
+  _bench(f"pack/{name}", pack)
+  _bench(f"unpack/{name} members", lambda: _unpack_members(cls, data))
+  _bench(f"unpack/{name}", lambda: cls.unpack(BytesIO(data)))
+
+
+def main() -> None:
+  with open(os.path.join(FILE_DIR, 'struct.ex'), encoding='utf-8') as f:
+    gen: dict = {}
+    exec(render(*parse(f.read())), gen)  # pylint: disable=exec-used
+
+  _bench_struct("fixed", gen['TestStruct'](
+      int1=5, int2=-1234, uint1=31, uint2=1234, float1=-1.23,
+      b1=True, b2=True, b3=False, data=b'\x01\x02\x03\x04', str=b'hey',
+  ))
+  _bench_struct("arrays", gen['ArrayStruct'](
+      a=[gen['Direction'].Left] * 3,
+      b=[gen['Ack'](code=127), gen['Ack'](code=64)],
+      c=[b'abc', b'def', b'ghi'],
+  ))
+  _bench_struct("scaled", gen['ScaledStruct'](
+      temperature=21.37, humidity=12.5, samples=[1.5, -0.0007, 2.0], clamped=[0.25] * 16,
+  ))
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,19 @@
+struct Ack {
+  code: uint8
+}
+
+struct Log {
+  text: string[]
+}
+
+protocol {
+  maxLength = 16
+  framing = COBS
+  crc = CRC8
+  fragmentation = true
+
+  messageIds {
+    Ack = 1
+    Log = 2
+  }
+}
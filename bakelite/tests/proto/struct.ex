@@ -66,4 +66,78 @@ struct VariableLength {
   a: bytes[]
   b: string[]
   c: uint8[]
-}
\ No newline at end of file
+}
+
+struct DeltaStruct {
+  @delta samples: int16[10]
+  @delta @varint wave: int32[]
+  @varint count: uint32
+  @varint offset: int64
+}
+
+enum ConversionRate: uint{2} {
+  Rate_27_5 = 0
+  Rate_55 = 1
+  Rate_110 = 2
+  Rate_220 = 3
+}
+
+bitfield struct ControlRegister {
+  oneShot: flag
+  conversionRate: ConversionRate
+  conversionFaults: uint{2}
+  outputPriority: flag
+  alertFunction: flag
+  shutdownMode: flag
+  reserved: unused{7}
+  offset: int{9}
+}
+
+struct WritePort {
+  portNum: uint8
+  bitfield {
+    pin1: flag
+    pin2: flag
+    pin3: flag
+    pin4: flag
+    level: int{4}
+  }
+  control: ControlRegister
+}
+
+struct Move {
+  x: int16
+  y: int16
+}
+
+union Command {
+  move: Move
+  speed: uint8
+  @varint steps: int32
+  label: string[]
+}
+
+struct HalfStruct {
+  a: float16
+  b: float16[]
+}
+
+struct ScaledStruct {
+  @scale(0.01) temperature: float32
+  @scale(0.5, uint8) @offset(-40) humidity: float32
+  @scale(0.001, int32) samples: float64[3]
+  @scale(0.1) clamped: float32[]
+}
+
+struct LogEvent {
+  @prefixed message: string[]
+  tail: string[]
+  @prefixed tags: string[][]
+}
+
+struct LargeSizes {
+  @size(uint16) data: bytes[]
+  @size(varint) values: uint16[]
+  @size(uint32) @prefixed name: string[]
+  @size(uint16) chunks: bytes[][]
+}
@@ -1,9 +1,11 @@
 """Tests for the frame class, CRC, and data encoding/decoding"""
 # pylint: disable=redefined-outer-name,unused-variable,expression-not-assigned,singleton-comparison
 
-from pytest import raises
+import random
 
-from bakelite.proto import CrcSize, framing
+from pytest import mark, raises
+
+from bakelite.proto import CrcSize, crc, framing
 
 
 def describe_encoder():
@@ -128,6 +130,40 @@ def describe_crc():
         framing.check_crc(b'hello world\x85\x11J\r', crc_size=CrcSize.CRC32)
     ) == b'hello world'
 
+  def crc_catalog_check_values(expect):
+    expect(crc.crc8(b'123456789')) == 0xF4
+    expect(crc.crc16(b'123456789')) == 0xBB3D
+    expect(crc.crc16_ccitt(b'123456789')) == 0x29B1
+    expect(crc.crc32(b'123456789')) == 0xCBF43926
+    expect(crc.crc32c(b'123456789')) == 0xE3069283
+
+  def checksum_check_values(expect):
+    expect(crc.fletcher16(b'abcde')) == 0xC8F0
+    expect(crc.fletcher16(b'abcdef')) == 0x2057
+    expect(crc.fletcher32(b'abcde')) == 0xF04FC729
+    expect(crc.fletcher32(b'abcdef')) == 0x56502D2A
+    expect(crc.adler32(b'Wikipedia')) == 0x11E60398
+
+  def append_checksum(expect):
+    expect(
+        framing.append_crc(b'abcde', crc_size=CrcSize.FLETCHER16)
+    ) == b'abcde\xf0\xc8'
+    expect(
+        framing.check_crc(b'abcde\xf0\xc8', crc_size=CrcSize.FLETCHER16)
+    ) == b'abcde'
+
+  def custom_crc(expect):
+    # CRC-16/KERMIT
+    kermit = crc.make_crc(crc.CrcAlgorithm(16, 0x1021, reflect=True))
+    expect(kermit(b'123456789')) == 0x2189
+
+  def append_crc_32bit_castagnoli(expect):
+    expect(
+        framing.check_crc(
+            framing.append_crc(b'hello world', crc_size=CrcSize.CRC32C),
+            crc_size=CrcSize.CRC32C)
+    ) == b'hello world'
+
 
 def describe_framer():
   def encode_frame(expect):
@@ -204,3 +240,30 @@ def describe_framer():
     framer.append_buffer(b'\x00\x06hello\x07world\x93\x00')
     framer.clear_buffer()
     expect(framer.decode_frame()) == None
+
+
+@mark.skipif(framing._native is None, reason="native extension not built")
+def describe_native():
+  def cobs_matches_python(expect):
+    rand = random.Random(1234)
+    for length in list(range(0, 600, 7)) + [253, 254, 255, 508, 509]:
+      data = bytes(rand.choice(b'\x00\x01\x7f\xff') if rand.random() < 0.3 else rand.randrange(1, 256)
+                   for _ in range(length))
+      encoded = framing.encode(data)
+      expect(encoded) == framing.encode_python(data)
+      expect(framing.decode(encoded)) == framing.decode_python(encoded) == data
+
+    run = b'A' * 254
+    expect(framing.encode(run)) == framing.encode_python(run)
+
+  def invalid_cobs_matches_python(expect):
+    with raises(framing.DecodeError):
+      framing.decode(b'\x05ab')
+    expect(framing.decode(b'\x03\x00a')) == framing.decode_python(b'\x03\x00a')
+
+  def crcs_match_python(expect):
+    rand = random.Random(5678)
+    for length in (0, 1, 2, 3, 15, 16, 17, 255, 1000, 5553):
+      data = bytes(rand.randrange(256) for _ in range(length))
+      for size, func in crc.python_crc_funcs.items():
+        expect(crc.crc_funcs[size](data)) == func(data)
@@ -5,7 +5,10 @@ import json
 import os
 from io import BytesIO
 
+import pytest
+
 from bakelite.generator import parse
+from bakelite.generator import cpptiny
 from bakelite.generator.python import render
 
 
@@ -44,3 +47,90 @@ def describe_protocol():
     proto2 = Protocol(stream=stream)
     msg = proto2.poll()
     expect(msg) == Ack(code=111)
+
+  def test_fragmented_message(expect):
+    gen = gen_code(FILE_DIR + '/fragment.ex')
+    Protocol = gen['Protocol']
+    Ack = gen['Ack']
+    Log = gen['Log']
+
+    stream = BytesIO()
+    proto = Protocol(stream=stream)
+
+    # Small messages are sent in one frame
+    proto.send(Ack(code=111))
+    expect(stream.getvalue()) == b'\x00\x04\x01o\x1f\x00'
+
+    text = b'A long log line, which will not fit in a single frame'
+    proto.send(Log(text=text))
+
+    stream.seek(0)
+    proto2 = Protocol(stream=stream)
+    expect(proto2.poll()) == Ack(code=111)
+
+    messages = [proto2.poll() for _ in range(5)]
+    expect(messages) == [None, None, None, None, Log(text=text)]
+
+  def test_lost_fragment(expect):
+    gen = gen_code(FILE_DIR + '/fragment.ex')
+    Protocol = gen['Protocol']
+    Ack = gen['Ack']
+    Log = gen['Log']
+
+    stream = BytesIO()
+    proto = Protocol(stream=stream)
+    proto.send(Log(text=b'A long log line, which will not fit in a single frame'))
+    frames = [frame for frame in stream.getvalue().split(b'\x00') if frame]
+    expect(len(frames)) == 5
+
+    # Drop the second fragment
+    stream = BytesIO(b''.join(b'\x00' + frame + b'\x00' for i, frame in enumerate(frames) if i != 1))
+    proto2 = Protocol(stream=stream)
+    messages = [proto2.poll() for _ in range(4)]
+    expect(messages) == [None, None, None, None]
+
+    # The next message still arrives
+    stream.seek(0)
+    stream.truncate()
+    Protocol(stream=stream).send(Ack(code=1))
+    stream.seek(0)
+    expect(proto2.poll()) == Ack(code=1)
+
+  def test_auto_max_length(expect):
+    text = """
+      struct Move {
+        x: int16
+        y: int16
+      }
+
+      struct Ack {
+        code: uint8
+      }
+
+      protocol {
+        maxLength = auto
+        framing = COBS
+        crc = CRC8
+
+        messageIds {
+          Move = 1
+          Ack = 2
+        }
+      }
+    """
+
+    # Sized to fit the largest message, plus its message ID
+    header = cpptiny.render(*parse(text))
+    expect("CobsFramer<Bakelite::Crc8, 5>" in header) == True
+    expect("static_assert(Move::maxPackedSize() <= 4" in header) == True
+
+    gbl = globals().copy()
+    exec(render(*parse(text)), gbl)
+    stream = BytesIO()
+    gbl['Protocol'](stream=stream).send(gbl['Move'](x=1, y=-1))
+    stream.seek(0)
+    expect(gbl['Protocol'](stream=stream).poll()) == gbl['Move'](x=1, y=-1)
+
+    # Messages without an upper bound can't be sized automatically
+    with pytest.raises(RuntimeError):
+      cpptiny.render(*parse(text.replace("code: uint8", "name: string[]")))
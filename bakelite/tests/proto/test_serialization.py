@@ -11,7 +11,7 @@ from pytest import approx, raises
 from bakelite.generator import parse
 from bakelite.generator.python import render
 from bakelite.proto.runtime import Registry
-from bakelite.proto.serialization import Packable, SerializationError, struct
+from bakelite.proto.serialization import Packable, SerializationError, _Array, _layout, _Run, struct
 
 
 FILE_DIR = dir_path = os.path.dirname(os.path.realpath(__file__))
@@ -212,3 +212,190 @@ def describe_serialization():
         b='This is a test string!'.encode('ascii'),
         c=[1, 2, 3, 4],
     )
+
+  def test_delta_struct(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    DeltaStruct = gen['DeltaStruct']
+
+    stream = BytesIO()
+    test_struct = DeltaStruct(
+        samples=[1000, 1002, 999, 1005, 1010, 1000, 990, 995, 1001, 1003],
+        wave=[100000, 100010, 100005, 99990, 100020],
+        count=300,
+        offset=-3,
+    )
+    test_struct.pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex(
+        'e8030200fdff06000500f6fff6ff05000600020005c09a0c14091d3cac0205')
+    stream.seek(0)
+    expect(DeltaStruct.unpack(stream)) == test_struct
+
+  def test_bitfield_struct(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    WritePort = gen['WritePort']
+    ControlRegister = gen['ControlRegister']
+    ConversionRate = gen['ConversionRate']
+
+    stream = BytesIO()
+    test_struct = WritePort(
+        portNum=7,
+        pin1=True,
+        pin2=False,
+        pin3=True,
+        pin4=True,
+        level=-3,
+        control=ControlRegister(
+            oneShot=True,
+            conversionRate=ConversionRate.Rate_110,
+            conversionFaults=3,
+            outputPriority=False,
+            alertFunction=True,
+            shutdownMode=False,
+            offset=-200,
+        ),
+    )
+    test_struct.pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex('07dd5d009c')
+    stream.seek(0)
+    expect(WritePort.unpack(stream)) == test_struct
+
+  def test_union(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    Command = gen['Command']
+    Move = gen['Move']
+
+    stream = BytesIO()
+    Command(move=Move(x=-2, y=300)).pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex('01feff2c01')
+    stream.seek(0)
+    expect(Command.unpack(stream)) == Command(move=Move(x=-2, y=300))
+
+    stream = BytesIO()
+    Command(steps=-150).pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex('03ab02')
+    stream.seek(0)
+    expect(Command.unpack(stream)) == Command(steps=-150)
+
+    stream = BytesIO()
+    Command().pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex('00')
+    stream.seek(0)
+    expect(Command.unpack(stream)) == Command()
+
+    with raises(SerializationError):
+      Command(speed=1, label=b'hi').pack(BytesIO())
+
+    with raises(SerializationError):
+      Command.unpack(BytesIO(bytes.fromhex('05')))
+
+  def test_half_struct(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    HalfStruct = gen['HalfStruct']
+
+    stream = BytesIO()
+    test_struct = HalfStruct(
+        a=-2.5,
+        b=[1.0, 0.1, 65504.0, 1e-7, 1e5, 0.5, -0.0, 3.140625, 2.0, 1024.0],
+    )
+    test_struct.pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex(
+        '00c10a003c662eff7b0200007c00380080484200400064')
+    stream.seek(0)
+    result = HalfStruct.unpack(stream)
+    expect(result.a) == -2.5
+    expect(result.b) == [
+        1.0, approx(0.1, abs=1e-4), 65504.0, approx(1.1920929e-7), float('inf'),
+        0.5, -0.0, 3.140625, 2.0, 1024.0,
+    ]
+
+  def test_scaled_struct(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    ScaledStruct = gen['ScaledStruct']
+
+    stream = BytesIO()
+    test_struct = ScaledStruct(
+        temperature=21.37,
+        humidity=12.5,
+        samples=[1.5, -0.0007, 2000000.0],
+        clamped=[4000.0, -4000.0, float('nan'), 0.26],
+    )
+    test_struct.pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex(
+        '590869dc050000ffffffff0094357704ff7f008000000300')
+    stream.seek(0)
+    result = ScaledStruct.unpack(stream)
+    expect(result.temperature) == approx(21.37)
+    expect(result.humidity) == 12.5
+    expect(result.samples) == approx([1.5, -0.001, 2000000.0])
+    expect(result.clamped) == approx([3276.7, -3276.8, 0.0, 0.3])
+
+  def test_prefixed_strings(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    LogEvent = gen['LogEvent']
+
+    stream = BytesIO()
+    test_struct = LogEvent(message=b'hello', tail=b'end', tags=[b'a', b'bc'])
+    test_struct.pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex('0568656c6c6f656e6400020161026263')
+    stream.seek(0)
+    expect(LogEvent.unpack(stream)) == LogEvent(message=b'hello', tail=b'end', tags=[b'a', b'bc'])
+
+  def test_large_sizes(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    LargeSizes = gen['LargeSizes']
+
+    stream = BytesIO()
+    test_struct = LargeSizes(
+        data=b'\xaa\xbb\xcc',
+        values=[1, 2, 3],
+        name=b'hi',
+        chunks=[b'\x11', b'\x22'],
+    )
+    test_struct.pack(stream)
+    expect(stream.getvalue()) == bytes.fromhex(
+        '0300aabbcc03010002000300020000006869' '0200010011010022')
+    stream.seek(0)
+    expect(LargeSizes.unpack(stream)) == test_struct
+
+    stream = BytesIO()
+    test_struct = LargeSizes(
+        data=bytes(range(256)) * 4,
+        values=list(range(200)),
+        name=b'x' * 300,
+        chunks=[],
+    )
+    test_struct.pack(stream)
+    stream.seek(0)
+    expect(LargeSizes.unpack(stream)) == test_struct
+
+    with raises(SerializationError):
+      LargeSizes(data=bytes(70000), values=[], name=b'', chunks=[]).pack(BytesIO())
+
+  def test_struct_layouts(expect):
+    gen = gen_code(FILE_DIR + '/struct.ex')
+    TestStruct = gen['TestStruct']
+    ArrayStruct = gen['ArrayStruct']
+    ScaledStruct = gen['ScaledStruct']
+    DeltaStruct = gen['DeltaStruct']
+    Ack = gen['Ack']
+    Direction = gen['Direction']
+
+    # Fixed size structs are packed with a single struct.Struct
+    for cls in (TestStruct, ArrayStruct):
+      layout = _layout(cls)
+      expect(len(layout)) == 1
+      expect(isinstance(layout[0], _Run)) == True
+
+    # Fixed runs are split by variable length members, and variable length
+    # arrays of fixed size elements are packed with one call
+    layout = _layout(ScaledStruct)
+    expect([type(step) for step in layout]) == [_Run, _Array]
+    expect(layout[0].names) == ['temperature', 'humidity', 'samples']
+    expect([isinstance(step, _Run) for step in _layout(DeltaStruct)]) == [False, False, False, False]
+
+    with raises(SerializationError):
+      ArrayStruct(a=[Direction.Left], b=[Ack(code=1), Ack(code=2)], c=[b'', b'', b'']).pack(BytesIO())
+    with raises(SerializationError):
+      ArrayStruct(
+          a=[Direction.Left] * 3, b=[Ack(code=1), Ack(code=2)], c=[b'', b'abcd', b'']
+      ).pack(BytesIO())
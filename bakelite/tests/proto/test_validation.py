@@ -91,3 +91,60 @@ def describe_validation():
       gen = gen_code(code)
 
     expect(str(exinfo.value)).includes("NotHere assigned a message ID, but not declared")
+
+  def test_delta_requires_integer_array(expect):
+    code = """
+      struct TestStruct {
+        @delta a: int32
+      }
+    """
+    with pytest.raises(ValidationError) as exinfo:
+      gen = gen_code(code)
+
+    expect(str(exinfo.value)).includes("TestStruct.a: @delta can only be used with arrays")
+
+  def test_bitfield_byte_aligned(expect):
+    code = """
+      bitfield struct TestStruct {
+        a: flag
+        b: uint{4}
+      }
+    """
+    with pytest.raises(ValidationError) as exinfo:
+      gen = gen_code(code)
+
+    expect(str(exinfo.value)).includes("TestStruct: bitfields must be a multiple of 8 bits, found 5 bits")
+
+  def test_union_requires_members(expect):
+    code = """
+      union Empty {
+        # No members yet
+      }
+    """
+    with pytest.raises(ValidationError) as exinfo:
+      gen = gen_code(code)
+
+    expect(str(exinfo.value)).includes("Empty: unions must have at least one member")
+
+  def test_union_none_reserved(expect):
+    code = """
+      union Command {
+        None: uint8
+        speed: uint8
+      }
+    """
+    with pytest.raises(ValidationError) as exinfo:
+      gen = gen_code(code)
+
+    expect(str(exinfo.value)).includes("Command.None: None is reserved for empty unions")
+
+  def test_scale_requires_float(expect):
+    code = """
+      struct TestStruct {
+        @scale(0.1) a: int32
+      }
+    """
+    with pytest.raises(ValidationError) as exinfo:
+      gen = gen_code(code)
+
+    expect(str(exinfo.value)).includes("TestStruct.a: @scale can only be used with float32 or float64")
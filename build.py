@@ -0,0 +1,67 @@
+"""Builds the optional native extension for the Python runtime.
+
+Poetry runs build() when building the package. Run this file directly
+to build the extension in place, for development and tests:
+
+  $ poetry run python build.py
+"""
+import os
+import re
+
+from setuptools import Distribution, Extension
+from setuptools.command.build_ext import build_ext
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+RUNTIME_DIR = os.path.join(ROOT, 'bakelite', 'generator', 'runtimes', 'cpptiny')
+TEMPLATE = os.path.join(ROOT, 'bakelite', 'generator', 'templates', 'cpptiny-bakelite.h.j2')
+BUILD_DIR = os.path.join(ROOT, 'build', 'native')
+
+
+def _read(path: str) -> str:
+  with open(path, encoding='utf-8') as f:
+    return f.read()
+
+
+def render_runtime() -> None:
+  """Writes the cpptiny runtime header the extension includes.
+
+  The runtime template only includes the runtime files, so this doesn't
+  need jinja, which isn't available to the build.
+  """
+  header = re.sub(
+      r"\{\{include\('([\w.]+)'\)\}\}",
+      lambda match: _read(os.path.join(RUNTIME_DIR, match.group(1))),
+      _read(TEMPLATE))
+
+  os.makedirs(BUILD_DIR, exist_ok=True)
+  with open(os.path.join(BUILD_DIR, 'bakelite.h'), 'w', encoding='utf-8') as f:
+    f.write(header)
+
+
+extensions = [
+    Extension(
+        'bakelite.proto._native',
+        sources=['bakelite/proto/_native.cpp'],
+        include_dirs=[BUILD_DIR],
+        extra_compile_args=['-std=c++14', '-O2'],
+        # Fall back to pure Python if there's no compiler
+        optional=True,
+    )
+]
+
+
+def build(setup_kwargs: dict) -> None:
+  render_runtime()
+  setup_kwargs.update({
+      'ext_modules': extensions,
+      'cmdclass': {'build_ext': build_ext},
+  })
+
+
+if __name__ == '__main__':
+  render_runtime()
+  distribution = Distribution({'name': 'bakelite', 'ext_modules': extensions})
+  command = build_ext(distribution)
+  command.inplace = True
+  command.ensure_finalized()
+  command.run()
@@ -0,0 +1,164 @@
+/*
+ * Decodes a recorded COBS stream on all cores.
+ *
+ *   ./replay generate stream.bin [frames]
+ *   ./replay decode stream.bin [threads]
+ *
+ * generate writes a test stream of TestMessage and Ack frames, with some
+ * line noise. decode maps a stream, decodes, checks and unpacks every
+ * frame with Bakelite::StreamDecoder, and prints what it found.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "proto.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The unpacked message, produced on the decoding threads
+struct Message {
+  Protocol::Message id = Protocol::Message::NoMessage;
+  int rcode = 0;
+  TestMessage test;
+  Ack ack;
+};
+
+static size_t writeOut(const char *data, size_t length) {
+  return fwrite(data, 1, length, stdout);
+}
+
+static int readNone() {
+  return -1;
+}
+
+static int generate(const char *path, long frames) {
+  if(freopen(path, "wb", stdout) == nullptr) {
+    perror(path);
+    return 1;
+  }
+
+  Protocol proto(readNone, writeOut);
+  for(long i = 0; i < frames; i++) {
+    if(i % 1000 == 999) {
+      // Line noise
+      fwrite("\x12\x34\x56\x00", 1, 4, stdout);
+    }
+
+    if(i % 4 == 0) {
+      Ack ack;
+      ack.code = (uint8_t)i;
+      snprintf(ack.message, sizeof(ack.message), "Frame %ld", i);
+      proto.send(ack);
+    }
+    else {
+      TestMessage msg;
+      msg.a = (uint8_t)i;
+      msg.b = (int32_t)i * 3;
+      msg.status = i % 2 == 0;
+      snprintf(msg.message, sizeof(msg.message), "%ld", i);
+      proto.send(msg);
+    }
+  }
+  return 0;
+}
+
+static int decode(const char *path, unsigned threads) {
+  int fd = open(path, O_RDONLY);
+  struct stat info;
+  if(fd < 0 || fstat(fd, &info) != 0) {
+    perror(path);
+    return 1;
+  }
+  size_t length = (size_t)info.st_size;
+  if(length == 0) {
+    fprintf(stderr, "%s is empty\n", path);
+    return 1;
+  }
+  auto data = (const char *)mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    perror(path);
+    return 1;
+  }
+  madvise((void *)data, length, MADV_SEQUENTIAL);
+
+  size_t acks = 0;
+  size_t tests = 0;
+  size_t failures = 0;
+  size_t unknown = 0;
+  int64_t sum = 0;
+
+  auto start = Clock::now();
+  Bakelite::StreamDecoder<Protocol::CrcType> decoder(threads);
+  size_t decoded = decoder.decode(data, length,
+    // On the decoding threads
+    [](const Bakelite::StreamFrame &frame) {
+      Message msg;
+      if(frame.length == 0) {
+        return msg;
+      }
+      Bakelite::BufferStream stream((char *)frame.data + 1, frame.length - 1);
+      msg.id = (Protocol::Message)frame.data[0];
+      switch(msg.id) {
+      case Protocol::Message::TestMessage:
+        msg.rcode = msg.test.unpack(stream);
+        break;
+      case Protocol::Message::Ack:
+        msg.rcode = msg.ack.unpack(stream);
+        break;
+      default:
+        msg.id = Protocol::Message::NoMessage;
+        break;
+      }
+      return msg;
+    },
+    // In stream order, on this thread
+    [&](const Bakelite::StreamFrame &frame, Message &msg) {
+      if(frame.status != Bakelite::CobsDecodeState::Decoded || msg.rcode != 0) {
+        failures++;
+      }
+      else if(msg.id == Protocol::Message::TestMessage) {
+        tests++;
+        sum += msg.test.b;
+      }
+      else if(msg.id == Protocol::Message::Ack) {
+        acks++;
+      }
+      else {
+        unknown++;
+      }
+    }
+  );
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  printf("TestMessage: %zu (sum of b: %lld)\n", tests, (long long)sum);
+  printf("Ack: %zu\n", acks);
+  printf("Unknown: %zu\n", unknown);
+  printf("Failures: %zu\n", failures);
+  if(decoded < length) {
+    printf("Incomplete frame: %zu bytes\n", length - decoded);
+  }
+  printf("%.3f s, %.1f MB/s, %.0f frames/s\n", elapsed, length / elapsed / 1e6,
+    (tests + acks + unknown + failures) / elapsed);
+
+  munmap((void *)data, length);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if(argc >= 3 && strcmp(argv[1], "generate") == 0) {
+    return generate(argv[2], argc >= 4 ? atol(argv[3]) : 1000000);
+  }
+  if(argc >= 3 && strcmp(argv[1], "decode") == 0) {
+    return decode(argv[2], argc >= 4 ? (unsigned)atoi(argv[3]) : 0);
+  }
+
+  fprintf(stderr, "Usage: %s generate stream.bin [frames]\n", argv[0]);
+  fprintf(stderr, "       %s decode stream.bin [threads]\n", argv[0]);
+  return 1;
+}